@@ -0,0 +1,239 @@
+#include "esp32HTTPbatcher.h"
+
+//**************************************************************************************************************
+esp32HTTPbatcher::esp32HTTPbatcher(const char* URL, const char* contentType)
+    : _pending(256, 1024)
+    , _maxBytes(4096)
+    , _maxRecords(0)
+    , _maxAge(60000)
+    , _idle(0)
+    , _maxPending(ESP32_HTTP_BATCHER_MAX_PENDING)
+    , _records(0)
+    , _oldest(0)
+    , _nextOldest(0)
+    , _newest(0)
+    , _failed(0)
+    , _retryWait(false)
+    , _HTTPcode(0)
+    , _flushLen(0)
+    , _flushRecords(0)
+    , _flushSent(0)
+    , _flushCB(nullptr)
+    , _flushCBarg(nullptr)
+{
+    threadLock = xSemaphoreCreateRecursiveMutex();
+    _URL = _strdup(URL);
+    _contentType = _strdup(contentType);
+    _separator = _strdup("\n");
+}
+
+//**************************************************************************************************************
+esp32HTTPbatcher::~esp32HTTPbatcher(){
+    delete[] _URL;
+    delete[] _contentType;
+    delete[] _separator;
+    vSemaphoreDelete(threadLock);
+}
+
+//**************************************************************************************************************
+void    esp32HTTPbatcher::setFlush(size_t maxBytes, size_t maxRecords, uint32_t maxAge, uint32_t idle){
+    _maxBytes = maxBytes;
+    _maxRecords = maxRecords;
+    _maxAge = maxAge;
+    _idle = idle;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPbatcher::setSeparator(const char* separator){
+    _seize;
+    delete[] _separator;
+    _separator = _strdup(separator ? separator : "");
+    _release;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPbatcher::setMaxPending(size_t bytes){
+    _maxPending = bytes;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPbatcher::onFlush(flushCB cb, void* arg){
+    _flushCB = cb;
+    _flushCBarg = arg;
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPbatcher::add(const char* record){
+    return add((const uint8_t*) record, strlen(record));
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPbatcher::add(const String& record){
+    return add((const uint8_t*) record.c_str(), record.length());
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPbatcher::add(const uint8_t* record, size_t len){
+    _seize;
+    size_t sepLen = strlen(_separator);
+    if(_pending.available() + len + sepLen > _maxPending){
+        _release;
+        return false;
+    }
+    size_t before = _pending.available();
+    if(_pending.write(record, len) != len ||
+       _pending.write((const uint8_t*) _separator, sepLen) != sepLen){
+        _pending.truncate(before);
+        _release;
+        return false;
+    }
+    _newest = millis();
+    if( ! _records++){
+        _oldest = _newest;
+    }
+    else if(_flushLen && _records == _flushRecords + 1){
+        _nextOldest = _newest;
+    }
+    _release;
+    return true;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPbatcher::poll(){
+    _seize;
+    size_t records = _records;
+    size_t bytes = _pending.available();
+    uint32_t now = millis();
+    bool due = _flushLen == 0 && records &&
+               (( _maxBytes && bytes >= _maxBytes) ||
+                ( _maxRecords && records >= _maxRecords) ||
+                ( _maxAge && (now - _oldest) >= _maxAge) ||
+                ( _idle && (now - _newest) >= _idle));
+    if(due && _retryWait && (now - _failed) < ESP32_HTTP_BATCHER_RETRY_MS){
+        due = false;
+    }
+    _release;
+    if(due){
+        flush();
+    }
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPbatcher::flush(){
+    _seize;
+    if(_flushLen || ! _records){
+        _release;
+        return _records == 0;
+    }
+    size_t records = _records;
+    _flushRecords = records;
+    _flushLen = _pending.available();
+    _release;
+
+            // The lock is not held while the request runs so that add() isn't
+            // blocked for the duration. Records added meanwhile follow
+            // _flushLen in _pending and are not part of this body.
+            // A kept connection the server closed while idle fails with
+            // nothing back: headers went out without a new connection and
+            // no response came. The body is still pending, so rewind and
+            // send it once more.
+
+    bool accepted = _post();
+    const esp32HTTPrequest::requestTimings& timings = _request.timings();
+    if( ! accepted && _HTTPcode == HTTPCODE_PERFORM_FAILED &&
+        timings.headersSent && ! timings.connected && ! timings.firstHeader){
+        accepted = _post();
+    }
+
+    _seize;
+    if(accepted){
+        _pending.consume(_flushLen);
+        _records -= records;
+        if(_records){
+            _oldest = _nextOldest;
+        }
+        _retryWait = false;
+    }
+    else {
+        _failed = millis();
+        _retryWait = true;
+    }
+    _flushLen = 0;
+    _release;
+    if(_flushCB){
+        _flushCB(_flushCBarg, this, _HTTPcode, accepted ? records : 0);
+    }
+    return accepted;
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPbatcher::_post(){
+    _flushSent = 0;
+    _request.async(false);
+    if( ! _request.open("POST", _URL)){
+        _HTTPcode = HTTPCODE_OPEN_FAILED;
+        return false;
+    }
+    _request.setReqHeader("Content-Type", _contentType);
+    _request.send([](void* arg, esp32HTTPrequest* request, uint8_t* buf, size_t len){
+                    return ((esp32HTTPbatcher*) arg)->_body(buf, len);
+                  }, _flushLen, this);
+    _HTTPcode = _request.responseHTTPcode();
+    return _HTTPcode >= 200 && _HTTPcode < 300;
+}
+
+//**************************************************************************************************************
+size_t  esp32HTTPbatcher::pending(){
+    _seize;
+    size_t bytes = _pending.available();
+    _release;
+    return bytes;
+}
+
+//**************************************************************************************************************
+size_t  esp32HTTPbatcher::pendingRecords(){
+    return _records;
+}
+
+//**************************************************************************************************************
+int     esp32HTTPbatcher::lastHTTPcode(){
+    return _HTTPcode;
+}
+
+//**************************************************************************************************************
+esp32HTTPrequest* esp32HTTPbatcher::request(){
+    return &_request;
+}
+
+//**************************************************************************************************************
+size_t  esp32HTTPbatcher::_body(uint8_t* buf, size_t len){
+
+            // bodyProviderCB: copy the next part of the flush from _pending
+            // without consuming it.
+
+    _seize;
+    if(len > _flushLen - _flushSent){
+        len = _flushLen - _flushSent;
+    }
+    size_t copied = 0;
+    xspan spans[4];
+    while(copied < len){
+        size_t count = _pending.spans(spans, 4, _flushSent + copied);
+        if( ! count) break;
+        for(size_t i=0; i<count && copied < len; i++){
+            size_t chunk = spans[i].len < len - copied ? spans[i].len : len - copied;
+            memcpy(buf + copied, spans[i].data, chunk);
+            copied += chunk;
+        }
+    }
+    _flushSent += copied;
+    _release;
+    return copied;
+}
+
+//**************************************************************************************************************
+char*   esp32HTTPbatcher::_strdup(const char* str){
+    char* copy = new char[strlen(str) + 1];
+    strcpy(copy, str);
+    return copy;
+}
@@ -0,0 +1,118 @@
+#ifndef esp32HTTPbatcher_h
+#define esp32HTTPbatcher_h "1.0.0"
+
+   /***********************************************************************************
+    Copyright (C) <2018>  <Bob Lemaire, IoTaWatt, Inc.>
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ************************** end of license section ****************************
+
+    esp32HTTPbatcher collects records (lines of line protocol, CSV rows, JSON
+    objects...) into a pending xbuf and POSTs them together as one body.
+
+    The pending batch is flushed by poll() when any of these is reached:
+      - pending bytes >= maxBytes
+      - pending records >= maxRecords
+      - oldest pending record is maxAge ms old
+      - no record has been added for idle ms (a burst has ended)
+    flush() sends whatever is pending immediately.
+
+    The batcher can't see whether the radio or link is idle, so "idle" means
+    the application has gone quiet: no add() for idle ms. Flushing then sends
+    a burst of readings as one POST as soon as the burst ends.
+
+    The body is read from the pending xbuf in place and only discarded when
+    the server answers 2xx, so a failed POST leaves the batch pending to be
+    retried (no sooner than ESP32_HTTP_BATCHER_RETRY_MS later). Records added
+    while a flush is in progress are kept for the next one.
+
+    The request keeps its connection, which returns to the esp32HTTPrequest
+    pool between flushes. Set ESP32_HTTP_REQUEST_POOL_IDLE_MS longer than the
+    usual time between flushes, or each flush will connect (and handshake)
+    again. If the server closed the kept connection meanwhile and the flush
+    fails with nothing back, it is sent once more on a new connection, as
+    the request itself can't rewind a body taken from a callback.
+
+    poll() and flush() send synchronously. add() may be called from other
+    tasks, it only waits for the short xbuf operations of a flush.
+
+***********************************************************************************/
+#include <Arduino.h>
+#include <esp32HTTPrequest.h>
+
+#ifndef ESP32_HTTP_BATCHER_MAX_PENDING
+  #define ESP32_HTTP_BATCHER_MAX_PENDING 16384        // add() fails when pending would exceed this
+#endif
+#ifndef ESP32_HTTP_BATCHER_RETRY_MS
+  #define ESP32_HTTP_BATCHER_RETRY_MS 10000           // Minimum wait after failed flush before poll() tries again
+#endif
+
+class esp32HTTPbatcher {
+
+  public:
+
+    typedef std::function<void(void*, esp32HTTPbatcher*, int HTTPcode, size_t records)> flushCB;
+
+    esp32HTTPbatcher(const char* URL, const char* contentType = "text/plain");
+    ~esp32HTTPbatcher();
+
+    void    setFlush(size_t maxBytes,                               // Flush thresholds, 0 = not used
+                     size_t maxRecords,
+                     uint32_t maxAge,                               // ms
+                     uint32_t idle = 0);                            // ms
+    void    setSeparator(const char*);                              // Appended to each record, default "\n"
+    void    setMaxPending(size_t);                                  // Limit pending bytes, add() fails beyond
+    void    onFlush(flushCB, void* arg = 0);                        // Notify result of each flush
+
+    bool    add(const char* record);                                // Append a record to pending batch
+    bool    add(const String& record);
+    bool    add(const uint8_t* record, size_t len);
+    void    poll();                                                 // Flush if a threshold is reached
+    bool    flush();                                                // Flush now, true if accepted (2xx)
+
+    size_t  pending();                                              // Bytes pending
+    size_t  pendingRecords();                                       // Records pending
+    int     lastHTTPcode();                                         // Result of last flush
+    esp32HTTPrequest* request();                                    // Request used to POST (setCert, setTimeout...)
+
+  private:
+
+    esp32HTTPrequest    _request;
+    xbuf                _pending;                   // records not yet accepted by server
+    SemaphoreHandle_t   threadLock;
+
+    char*       _URL;
+    char*       _contentType;
+    char*       _separator;
+    size_t      _maxBytes;
+    size_t      _maxRecords;
+    uint32_t    _maxAge;
+    uint32_t    _idle;
+    size_t      _maxPending;
+    size_t      _records;                           // records in _pending
+    uint32_t    _oldest;                            // millis() when first pending record was added
+    uint32_t    _nextOldest;                        // millis() when first record after flush in progress was added
+    uint32_t    _newest;                            // millis() when last record was added
+    uint32_t    _failed;                            // millis() of last failed flush
+    bool        _retryWait;                         // last flush failed, poll() waits before retry
+    int         _HTTPcode;
+    size_t      _flushLen;                          // bytes of _pending in flush in progress
+    size_t      _flushRecords;                      // records in flush in progress
+    size_t      _flushSent;                         // bytes of those given to the request so far
+    flushCB     _flushCB;
+    void*       _flushCBarg;
+
+    char*       _strdup(const char*);
+    size_t      _body(uint8_t* buf, size_t len);
+    bool        _post();
+};
+#endif
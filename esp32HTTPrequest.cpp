@@ -1,5 +1,35 @@
 #include "esp32HTTPrequest.h"
 
+// esp_http_client does not expose TLS session resumption, so the only
+// way to avoid a handshake is to keep the established connection with its
+// handle, both in the instance and in the connection pool below. An HTTPS
+// send on a handle that is still connected does not handshake, so it holds
+// TLSlock_S only briefly, but it still takes it. The counts are of HTTPS
+// sends each way.
+
+static uint32_t tlsReusedCount = 0;
+static uint32_t tlsHandshakeCount = 0;
+static portMUX_TYPE tlsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Hook called with the timings of every completed request.
+
+static esp32HTTPrequest::timingsCB timingsHook = nullptr;
+
+// Heap use of all instances, updated with each instance's _allocs.
+
+static esp32HTTPrequest::allocStats allocTotal = {0, 0, 0, 0};
+static portMUX_TYPE allocMux = portMUX_INITIALIZER_UNLOCKED;
+
+#if ESP32_HTTP_REQUEST_LOG == 1
+
+// Ring buffer of trace records shared by all instances.
+
+esp32HTTPrequest::traceRecord esp32HTTPrequest::_traceRing[ESP32_HTTP_REQUEST_TRACE_DEPTH];
+static size_t traceNext = 0;
+static size_t traceCount = 0;
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
 // ESP32 does not seem to reliably handle multiple cocurrent TLS requests.
 // This semaphore controls the number of concurrent requests.
 // ESP32_HTTP_REQUEST_MAX_TLS can be set to allow more than one.
@@ -8,6 +38,80 @@
 
 SemaphoreHandle_t TLSlock_S = nullptr;
 
+// Idle esp_http_client handles are kept in this pool when a request completes
+// so that a later open() to the same scheme/host/port by any instance can reuse
+// the connection, avoiding another TCP connect and TLS handshake.
+// The pool is protected by poolLock_S. There is no timer, idle connections
+// are closed when a request checks a client out or in, or by closeIdle().
+// An established TLS session holds tens of KB, so no more than
+// ESP32_HTTP_REQUEST_MAX_TLS connected HTTPS clients are kept idle; checking
+// in another closes the one idle longest.
+
+struct poolEntry {
+    esp_http_client_handle_t client;
+    char*           origin;                     // scheme://host:port
+    const uint8_t*  cert;                       // .pem used to init client
+    bool            globalCA;                   // client uses global CA store
+    bool            connected;                  // session still established
+    bool            streamed;                   // last used with open/write/read, not perform
+    uint32_t        URL;                        // serial of URL last set in client
+    uint32_t        lastUsed;                   // millis() when returned to pool
+};
+
+static poolEntry connectionPool[ESP32_HTTP_REQUEST_POOL_SIZE];
+static uint32_t URLserial = 0;                  // last URL::serial issued, under poolLock_S
+SemaphoreHandle_t poolLock_S = nullptr;
+
+static void poolRemove(poolEntry* entry){
+    esp_http_client_cleanup(entry->client);
+    delete[] entry->origin;
+    memset(entry, 0, sizeof(poolEntry));
+}
+
+static bool poolTLS(const poolEntry* entry){
+    return entry->client && entry->connected && strncmp(entry->origin, "HTTPS:", 6) == 0;
+}
+
+static void poolLimitTLS(int keep){
+    while(true){
+        int count = 0;
+        poolEntry* oldest = nullptr;
+        for(int i=0; i<ESP32_HTTP_REQUEST_POOL_SIZE; i++){
+            poolEntry* entry = &connectionPool[i];
+            if(poolTLS(entry)){
+                count++;
+                if( ! oldest || entry->lastUsed < oldest->lastUsed) oldest = entry;
+            }
+        }
+        if(count <= keep) return;
+        poolRemove(oldest);
+    }
+}
+
+static void poolExpire(){
+    for(int i=0; i<ESP32_HTTP_REQUEST_POOL_SIZE; i++){
+        if(connectionPool[i].client && (millis() - connectionPool[i].lastUsed) > ESP32_HTTP_REQUEST_POOL_IDLE_MS){
+            poolRemove(&connectionPool[i]);
+        }
+    }
+}
+
+// Requests sent with async(true) are queued here and serviced by a
+// fixed pool of ESP32_HTTP_REQUEST_ASYNC_TASKS worker tasks.
+// The queue and tasks are created the first time async(true) is called,
+// under poolLock_S so that two tasks doing that at once create them once.
+
+QueueHandle_t asyncQueue_Q = nullptr;
+
+static void asyncTask(void*){
+    esp32HTTPrequest* request;
+    while(true){
+        if(xQueueReceive(asyncQueue_Q, &request, portMAX_DELAY) == pdTRUE){
+            request->_asyncSend();
+        }
+    }
+}
+
 //**************************************************************************************************************
 esp32HTTPrequest::esp32HTTPrequest()
     : _readyState(readyStateUnsent)
@@ -15,42 +119,85 @@ esp32HTTPrequest::esp32HTTPrequest()
     , _chunked(false)
     , _debug(DEBUG_IOTA_HTTP_SET)
     , _async(false)
+    , _holdClient(false)
+    , _compress(false)
+    , _asyncPending(false)
     , _timeout(DEFAULT_RX_TIMEOUT)
     , _lastActivity(0)
     , _requestStartTime(0)
     , _requestEndTime(0)
     , _connectedPort(-1)
     , _client(nullptr)
+    , _clientOrigin(nullptr)
+    , _clientConnected(false)
+    , _clientStreamed(false)
+    , _clientURL(0)
     , _contentLength(0)
     , _contentRead(0)
     , _readyStateChangeCB(nullptr)
     , _readyStateChangeCBarg(nullptr)
     , _onDataCB(nullptr)
     , _onDataCBarg(nullptr)
+    , _bodyProviderCB(nullptr)
+    , _bodyProviderCBarg(nullptr)
+    , _sinkCB(nullptr)
+    , _sinkCBarg(nullptr)
+    , _sinkPrint(nullptr)
+    , _sinkFailed(false)
+    , _maxBuffer(0)
+    , _peakBuffered(0)
+    , _rxOverflow(false)
+    , _respReceived(false)
     , _URL(nullptr)
     , _cert_pem(nullptr)
     , _cert_len(0)
     , _useGlobalCAStore(false)
-    , _request(nullptr), _response(nullptr), _headers(nullptr)
+    , _requestBuf(nullptr), _requestBufOwned(false), _requestBody(nullptr)
+    , _gzip(nullptr), _gzipOut(nullptr), _gzipDone(false)
+    , _response(nullptr), _headerIndex(nullptr), _headerCount(0), _headerIndexSize(0)
+    , _headerArena(nullptr)
+    , _respContentType(nullptr), _respETag(nullptr), _respContentLength(-1), _respClose(false)
+    , _keepCount(0)
 {
     DEBUG_HTTP("New request.");
+    memset(&_timings, 0, sizeof(_timings));
+    memset(&_allocs, 0, sizeof(_allocs));
+    memset(_headerHash, 0, sizeof(_headerHash));
     threadLock = xSemaphoreCreateRecursiveMutex();
+    bufferLock = xSemaphoreCreateRecursiveMutex();
     if( ! TLSlock_S){
         TLSlock_S = xSemaphoreCreateCounting(ESP32_HTTP_REQUEST_MAX_TLS, ESP32_HTTP_REQUEST_MAX_TLS);
     } 
+    if( ! poolLock_S){
+        poolLock_S = xSemaphoreCreateMutex();
+    }
 }
 
 //**************************************************************************************************************
 esp32HTTPrequest::~esp32HTTPrequest(){
-    if(_client){
-        esp_http_client_cleanup(_client);
-        _client = nullptr;
+    while(_asyncPending){
+        vTaskDelay(1);
+    }
+    _seize;
+    _release;
+    _checkin();
+    if(_clientOrigin){
+        _alloc(-(int32_t)(strlen(_clientOrigin) + 1));
+        delete[] _clientOrigin;
+    }
+    while(_headerArena){
+        headerBlock* block = _headerArena;
+        _headerArena = block->next;
+        _alloc(-(int32_t)(sizeof(headerBlock) + block->size));
+        free(block);
+    }
+    _deleteXbuf(_response);
+    if(_URL){
+        _alloc(-(int32_t)(sizeof(URL) + (_URL->buffer != _URL->storage ? _URL->size : 0)));
+        delete _URL;
     }
-    delete _headers;
-    delete _request;
-    delete _response;
-    delete _URL;
     vSemaphoreDelete(threadLock);
+    vSemaphoreDelete(bufferLock);
 }
 
 //**************************************************************************************************************
@@ -67,6 +214,28 @@ bool    esp32HTTPrequest::debug(){
     return(_debug);
 }
 
+//**************************************************************************************************************
+void    esp32HTTPrequest::async(bool set){
+    DEBUG_HTTP("async(%s)\r\n", set ? "true" : "false");
+    if(set){
+        xSemaphoreTake(poolLock_S, portMAX_DELAY);
+        if( ! asyncQueue_Q){
+            asyncQueue_Q = xQueueCreate(ESP32_HTTP_REQUEST_ASYNC_QUEUE, sizeof(esp32HTTPrequest*));
+            for(int i=0; i<ESP32_HTTP_REQUEST_ASYNC_TASKS; i++){
+                xTaskCreate(asyncTask, "esp32HTTPrequest", ESP32_HTTP_REQUEST_ASYNC_STACK, nullptr, ESP32_HTTP_REQUEST_ASYNC_PRIORITY, nullptr);
+            }
+        }
+        xSemaphoreGive(poolLock_S);
+    }
+    _async = set;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPrequest::compress(bool set){
+    DEBUG_HTTP("compress(%s)\r\n", set ? "true" : "false");
+    _compress = set;
+}
+
 //**************************************************************************************************************
 void    esp32HTTPrequest::setCert(const uint8_t* pem, size_t len){
     _cert_pem = pem;
@@ -80,18 +249,32 @@ void    esp32HTTPrequest::useGlobalCAStore(bool globalCA){
 //**************************************************************************************************************
 bool	esp32HTTPrequest::open(const char* method, const char* url){
     DEBUG_HTTP("open(%s, %.*s)\r\n", method, strlen(url), url);
+
+            // Waits for a send() in progress in another task. A request
+            // queued or still in its async worker can't be reopened.
+
+    _seize;
+    bool result = ! _asyncPending && _open(method, url);
+    _release;
+    return result;
+}
+
+//**************************************************************************************************************
+bool	esp32HTTPrequest::_open(const char* method, const char* url){
     if(_readyState != readyStateUnsent && _readyState != readyStateDone) {return false;}
     _requestStartTime = millis();
-    delete _headers;
-    delete _request;
-    delete _response;
-    _headers = nullptr;
-    _response = nullptr;
-    _request = nullptr;
-    _chunked = false;
-    _contentRead = 0;
+    memset(&_timings, 0, sizeof(_timings));
+    _timings.start = micros();
+    _allocs.count = 0;
+    _allocs.bytes = 0;
+    _allocs.peak = _allocs.held;
+    _headerReset();
+    _responseReset();
     _readyState = readyStateUnsent;
-    if( ! _parseURL(url)){
+    if(_URL && _URL->url && strcmp(url, _URL->url) == 0){
+        DEBUG_HTTP("URL unchanged\r\n");
+    }
+    else if( ! _parseURL(url)){
         DEBUG_HTTP("_parseURL failed\n");
         return false;
     }
@@ -103,6 +286,14 @@ bool	esp32HTTPrequest::open(const char* method, const char* url){
     } else 
         return false;
 
+    if(_client && strcmp(_URL->origin, _clientOrigin) != 0){
+        _checkin();
+    }
+    if( ! _client && _checkout(_URL->origin)){
+        DEBUG_HTTP("reusing pooled connection\r\n");
+        esp_http_client_set_user_data(_client, this);
+    }
+
     if(!_client){
         esp_http_client_config_t config;
         memset(&config, 0, sizeof(config));
@@ -122,8 +313,11 @@ bool	esp32HTTPrequest::open(const char* method, const char* url){
     }
     else {
         esp_http_client_set_method(_client, _HTTPmethod);
-        esp_http_client_set_url(_client, url);
+        if(_clientURL != _URL->serial){
+            esp_http_client_set_url(_client, url);
+        }
     }
+    _clientURL = _URL->serial;
     _lastActivity = millis();
     return true;
 }
@@ -139,62 +333,191 @@ void	esp32HTTPrequest::setTimeout(int seconds){
     _timeout = seconds;
 }
 
+//**************************************************************************************************************
+void	esp32HTTPrequest::setMaxBuffer(size_t bytes){
+    DEBUG_HTTP("setMaxBuffer(%d)\r\n", bytes);
+    _maxBuffer = bytes;
+}
+
+//**************************************************************************************************************
+bool	esp32HTTPrequest::keepRespHeaders(std::initializer_list<const char*> names){
+    DEBUG_HTTP("keepRespHeaders(%d)\r\n", names.size());
+    if(names.size() > ESP32_HTTP_REQUEST_KEEP_HEADERS) return false;
+    _keepCount = 0;
+    for(const char* name : names){
+        _keepHeaders[_keepCount] = name;
+        _keepHashes[_keepCount++] = _headerHashOf(name);
+    }
+    return true;
+}
+
 //**************************************************************************************************************
 bool	esp32HTTPrequest::send(){
     DEBUG_HTTP("send()\r\n");
     _seize;
-    _send(_request, 0);
+    bool result = _dispatch(nullptr, 0);
     _release;
-    return true;
+    return result;
 }
 
 //**************************************************************************************************************
-bool    esp32HTTPrequest::send(String body){
-    DEBUG_HTTP("send(String) %s... (%d)\r\n", body.substring(0,16).c_str(), body.length());
+bool    esp32HTTPrequest::send(const String& body){
+    DEBUG_HTTP("send(String&) %.16s... (%d)\r\n", body.c_str(), body.length());
     _seize;
-    _request = (char *)ps_malloc(body.length()); //new char[body.length()];
-    memcpy(_request, body.c_str(), body.length());
-    _send(_request, body.length());
+    bool result;
+    if(_async){
+        result = send(String(body));
+    }
+    else {
+        result = _dispatch(body.c_str(), body.length());
+    }
     _release;
-    return true;
+    return result;
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPrequest::send(String&& body){
+    DEBUG_HTTP("send(String&&) %.16s... (%d)\r\n", body.c_str(), body.length());
+    _seize;
+    bool result;
+    if(_async){
+        _requestString = std::move(body);
+        result = _dispatch(_requestString.c_str(), _requestString.length());
+        if( ! result){
+            _requestString = String();
+        }
+    }
+    else {
+        result = _dispatch(body.c_str(), body.length());
+    }
+    _release;
+    return result;
 }
 
 //**************************************************************************************************************
 bool	esp32HTTPrequest::send(const char* body){
-    DEBUG_HTTP("send(char*) %s.16... (%d)\r\n",body, strlen(body));
+    DEBUG_HTTP("send(char*) %.16s... (%d)\r\n",body, strlen(body));
     _seize;
-    _send(body, strlen(body));
+    bool result = _dispatch(body, strlen(body));
     _release;
-    return true;
+    return result;
 }
 
 //**************************************************************************************************************
 bool	esp32HTTPrequest::send(const uint8_t* body, size_t len){
-    DEBUG_HTTP("send(char*) %s.16... (%d)\r\n",(char*)body, len);
+    DEBUG_HTTP("send(uint8_t*) (%d)\r\n", len);
     _seize;
-    _send((char*)body, len);
+    bool result = _dispatch((char*)body, len);
     _release;
-    return true;
+    return result;
 }
 
 //**************************************************************************************************************
 bool	esp32HTTPrequest::send(xbuf* body, size_t len){
-    DEBUG_HTTP("send(char*) %s.16... (%d)\r\n", body->peekString(16).c_str(), len);
+    DEBUG_HTTP("send(xbuf*) (%d)\r\n", len);
     _seize;
-    _request = (char *)ps_malloc(len);
-    body->read((uint8_t*)_request, len);
-    _send(_request, len);
+    if(len > body->available()){
+        len = body->available();
+    }
+
+            // An async body is moved to a copy the request owns, so the
+            // caller can reuse its xbuf. If there isn't memory for the
+            // copy, the send fails and the body is discarded.
+
+    bool result = true;
+    if(_async){
+        _requestBuf = _newXbuf(64);
+        _requestBufOwned = true;
+        if(_requestBuf->write(body, len) != len){
+            DEBUG_HTTP("send(xbuf*) no memory for copy\r\n");
+            body->consume(len);
+            result = false;
+        }
+    }
+    else {
+        _requestBuf = body;
+        _requestBufOwned = false;
+    }
+    result = result && _dispatch(nullptr, len);
+    if( ! result && _requestBufOwned){
+        _deleteXbuf(_requestBuf);
+        _requestBuf = nullptr;
+    }
     _release;
-    return true;
+    return result;
+}
+
+//**************************************************************************************************************
+bool	esp32HTTPrequest::send(bodyProviderCB cb, size_t len, void* arg){
+    DEBUG_HTTP("send(bodyProviderCB) (%d)\r\n", len == HTTP_REQUEST_CHUNKED ? -1 : (int)len);
+    _seize;
+    _bodyProviderCB = cb;
+    _bodyProviderCBarg = arg;
+    bool result = _dispatch(nullptr, len);
+    if( ! result){
+        _bodyProviderCB = nullptr;
+    }
+    _release;
+    return result;
+}
+
+//**************************************************************************************************************
+size_t  esp32HTTPrequest::sendBatch(const batchRequest* requests, size_t count, batchCB cb, void* arg, batchDoneCB done){
+    DEBUG_HTTP("sendBatch(%d)\r\n", count);
+    _seize;
+
+            // Requests are sent synchronously one after the other. The client
+            // is held rather than returned to the pool after each send, so
+            // consecutive requests to one origin share the connection and
+            // only the first pays for the connect and handshake. Each
+            // request still waits for its response, as esp_http_client
+            // has no pipelining, so a batch takes a round trip per request.
+            // A request that gets no complete response ends the batch; it
+            // isn't counted and its callback isn't made, so the count
+            // returned is also the index of the one that failed.
+
+    bool async = _async;
+    _async = false;
+    _holdClient = true;
+    size_t sent = 0;
+    while(sent < count){
+        const batchRequest* request = &requests[sent];
+        if( ! open(request->method, request->URL)){
+            break;
+        }
+        if(request->contentType){
+            setReqHeader("Content-Type", request->contentType);
+        }
+        send((const uint8_t*) request->body, request->body ? request->len : 0);
+        if(_readyState != readyStateDone || _HTTPcode < 0){
+            DEBUG_HTTP("sendBatch failed at %d, code %d\r\n", sent, _HTTPcode);
+            break;
+        }
+        sent++;
+        if(cb && ! cb(arg, this, sent - 1)){
+            break;
+        }
+    }
+    _holdClient = false;
+    _checkin();
+    _async = async;
+    if(done){
+        done(arg, this, sent);
+    }
+    _release;
+    return sent;
 }
 
 //**************************************************************************************************************
 void    esp32HTTPrequest::abort(){
     DEBUG_HTTP("abort()\r\n");
     _seize;
-    if(! _client) return;
-    esp_http_client_cleanup(_client);
-    _client = nullptr;
+    if(_client){
+        esp_http_client_cleanup(_client);
+        _client = nullptr;
+        _clientConnected = false;
+        _clientStreamed = false;
+    }
     _release;
 }
 //**************************************************************************************************************
@@ -209,59 +532,98 @@ int	esp32HTTPrequest::responseHTTPcode(){
 
 //**************************************************************************************************************
 String	esp32HTTPrequest::responseText(){
+    String localString;
+    responseText(localString);
+    return localString;
+}
+
+//**************************************************************************************************************
+size_t	esp32HTTPrequest::responseText(String& text){
     DEBUG_HTTP("responseText() ");
-    _seize;
+    _seizeBuffer;
     if( ! _response || _readyState < readyStateLoading || ! available()){
         DEBUG_HTTP("responseText() no data\r\n");
-        _release;
-        return String(); 
+        _releaseBuffer;
+        return 0; 
     }       
     size_t avail = available();
-    String localString = _response->readString(avail);
-    if(localString.length() < avail) {
-        DEBUG_HTTP("!responseText() no buffer\r\n")
+    size_t read = _response->readString(text, avail);
+    _contentRead += read;
+    _releaseBuffer;
+    if(read < avail) {
+        DEBUG_HTTP("!responseText() no buffer\r\n");
         _HTTPcode = HTTPCODE_TOO_LESS_RAM;
-        esp_http_client_close(_client);
-        _client = nullptr;
-        return String();
+        abort();
+        return 0;
     }
-    _contentRead += localString.length();
-    DEBUG_HTTP("responseText() %s... (%d)\r\n", localString.substring(0,16).c_str() , avail);
-    _release;
-    return localString;
+    DEBUG_HTTP("responseText() %.16s... (%d)\r\n", text.c_str() + text.length() - read, avail);
+    return read;
 }
 
 //**************************************************************************************************************
 size_t  esp32HTTPrequest::responseRead(uint8_t* buf, size_t len){
+    _seizeBuffer;
     if( ! _response || _readyState < readyStateLoading || ! available()){
         DEBUG_HTTP("responseRead() no data\r\n");
+        _releaseBuffer;
         return 0;
     } 
-    _seize;
     size_t avail = available() > len ? len : available();
     _response->read(buf, avail);
     DEBUG_HTTP("responseRead() %.16s... (%d)\r\n", (char*)buf , avail);
     _contentRead += avail;
-    _release;
+    _releaseBuffer;
     return avail;
 }
 
+//**************************************************************************************************************
+size_t  esp32HTTPrequest::responseSpans(xspan* spans, size_t count){
+    _seizeBuffer;
+    size_t filled = 0;
+    if(_response && _readyState >= readyStateLoading){
+        filled = _response->spans(spans, count);
+    }
+    _releaseBuffer;
+    return filled;
+}
+
+//**************************************************************************************************************
+size_t  esp32HTTPrequest::responseConsume(size_t len){
+    _seizeBuffer;
+    size_t consumed = 0;
+    if(_response && _readyState >= readyStateLoading){
+        consumed = _response->consume(len);
+        DEBUG_HTTP("responseConsume() (%d)\r\n", consumed);
+        _contentRead += consumed;
+    }
+    _releaseBuffer;
+    return consumed;
+}
+
 //**************************************************************************************************************
 size_t	esp32HTTPrequest::available(){
     if(_readyState < readyStateLoading) return 0;
-    if(_chunked && (_contentLength - _contentRead) < _response->available()){
-        return _contentLength - _contentRead;
+    _seizeBuffer;
+    size_t avail = _response ? _response->available() : 0;
+    if(_chunked && (_contentLength - _contentRead) < avail){
+        avail = _contentLength - _contentRead;
     }
-    if( ! _response){
-        return 0;
-    }
-    return _response->available();
+    _releaseBuffer;
+    return avail;
 }
 
 //**************************************************************************************************************
 size_t	esp32HTTPrequest::responseLength(){
     if(_readyState < readyStateLoading) return 0;
-    return _contentLength;
+    _seizeBuffer;
+    size_t length = _contentLength;
+    _releaseBuffer;
+    return length;
+}
+
+//**************************************************************************************************************
+size_t	esp32HTTPrequest::peakBuffered(){
+    return _peakBuffered;
 }
 
 //**************************************************************************************************************
@@ -271,6 +633,21 @@ void	esp32HTTPrequest::onData(onDataCB cb, void* arg){
     _onDataCBarg = arg;
 }
 
+//**************************************************************************************************************
+void	esp32HTTPrequest::responseSink(Print* sink){
+    DEBUG_HTTP("responseSink(Print) %s\r\n", sink ? "set" : "cleared");
+    _sinkPrint = sink;
+    _sinkCB = nullptr;
+}
+
+//**************************************************************************************************************
+void	esp32HTTPrequest::responseSink(sinkCB cb, void* arg){
+    DEBUG_HTTP("responseSink(CB) %s\r\n", cb ? "set" : "cleared");
+    _sinkCB = cb;
+    _sinkCBarg = arg;
+    _sinkPrint = nullptr;
+}
+
 //**************************************************************************************************************
 uint32_t esp32HTTPrequest::elapsedTime(){
     if(_readyState <= readyStateOpened) return 0;
@@ -280,11 +657,109 @@ uint32_t esp32HTTPrequest::elapsedTime(){
     return _requestEndTime - _requestStartTime;
 }
 
+//**************************************************************************************************************
+const esp32HTTPrequest::requestTimings& esp32HTTPrequest::timings(){
+    return _timings;
+}
+
+//**************************************************************************************************************
+void esp32HTTPrequest::onTimings(timingsCB cb){
+    timingsHook = cb;
+}
+
+//**************************************************************************************************************
+const esp32HTTPrequest::allocStats& esp32HTTPrequest::allocations(){
+    return _allocs;
+}
+
+//**************************************************************************************************************
+esp32HTTPrequest::allocStats esp32HTTPrequest::totalAllocations(){
+    portENTER_CRITICAL(&allocMux);
+    allocStats stats = allocTotal;
+    portEXIT_CRITICAL(&allocMux);
+    return stats;
+}
+
+//**************************************************************************************************************
+void esp32HTTPrequest::dumpTrace(Print& out){
+#if ESP32_HTTP_REQUEST_LOG == 1
+    traceRecord record;
+    while(true){
+        portENTER_CRITICAL(&traceMux);
+        if( ! traceCount){
+            portEXIT_CRITICAL(&traceMux);
+            break;
+        }
+        record = _traceRing[(traceNext + ESP32_HTTP_REQUEST_TRACE_DEPTH - traceCount) % ESP32_HTTP_REQUEST_TRACE_DEPTH];
+        traceCount--;
+        portEXIT_CRITICAL(&traceMux);
+        for(int i=0; i<2; i++){
+            if(record.textArg[i]){
+                record.arg[record.textArg[i] - 1] = (uintptr_t) record.text[i];
+            }
+        }
+        out.printf("Trace(%p %3ld): ", record.request, (long) record.time);
+        out.printf_P(record.format, record.arg[0], record.arg[1], record.arg[2], record.arg[3], record.arg[4], record.arg[5]);
+    }
+#endif
+}
+
+#if ESP32_HTTP_REQUEST_LOG == 1
+//**************************************************************************************************************
+void esp32HTTPrequest::_traceArg(traceRecord& record, int& argNdx, int& textNdx, const char* arg){
+    if(argNdx >= 6) return;
+    if(textNdx >= 2 || ! arg){
+        arg = "?";
+    }
+    else {
+        strncpy(record.text[textNdx], arg, sizeof(record.text[0]) - 1);
+        record.text[textNdx][sizeof(record.text[0]) - 1] = 0;
+        record.textArg[textNdx++] = argNdx + 1;
+    }
+    record.arg[argNdx++] = (uintptr_t) arg;
+}
+
+//**************************************************************************************************************
+void esp32HTTPrequest::_traceAdd(const traceRecord& record){
+    portENTER_CRITICAL(&traceMux);
+    _traceRing[traceNext] = record;
+    traceNext = (traceNext + 1) % ESP32_HTTP_REQUEST_TRACE_DEPTH;
+    if(traceCount < ESP32_HTTP_REQUEST_TRACE_DEPTH){
+        traceCount++;
+    }
+    portEXIT_CRITICAL(&traceMux);
+}
+#endif
+
 //**************************************************************************************************************
 String esp32HTTPrequest::version(){
     return String(esp32HTTPrequest_h);
 }
 
+//**************************************************************************************************************
+void    esp32HTTPrequest::closeIdle(){
+    if( ! poolLock_S) return;
+    xSemaphoreTake(poolLock_S, portMAX_DELAY);
+    poolExpire();
+    xSemaphoreGive(poolLock_S);
+}
+
+//**************************************************************************************************************
+uint32_t esp32HTTPrequest::tlsReused(){
+    portENTER_CRITICAL(&tlsMux);
+    uint32_t count = tlsReusedCount;
+    portEXIT_CRITICAL(&tlsMux);
+    return count;
+}
+
+//**************************************************************************************************************
+uint32_t esp32HTTPrequest::tlsHandshakes(){
+    portENTER_CRITICAL(&tlsMux);
+    uint32_t count = tlsHandshakeCount;
+    portEXIT_CRITICAL(&tlsMux);
+    return count;
+}
+
 /*______________________________________________________________________________________________________________
 
                PPPP    RRRR     OOO    TTTTT   EEEEE    CCC    TTTTT   EEEEE   DDDD
@@ -294,43 +769,480 @@ String esp32HTTPrequest::version(){
                P       R   R    OOO      T     EEEEE    CCC      T     EEEEE   DDDD
 _______________________________________________________________________________________________________________*/
 
+// Send now or, when async, queue the request for a worker task and return.
+// Contiguous buffers passed to send() must remain valid until readyStateDone.
+
+bool  esp32HTTPrequest::_dispatch(const char* body, size_t len){
+    if( ! _async){
+        _send(body, len);
+        return true;
+    }
+    _requestBody = body;
+    _requestLen = len;
+    _asyncPending = true;
+    esp32HTTPrequest* request = this;
+    if(xQueueSend(asyncQueue_Q, &request, 0) != pdTRUE){
+        DEBUG_HTTP("async queue full\r\n");
+        _asyncPending = false;
+        return false;
+    }
+    return true;
+}
+
+//**************************************************************************************************************
+void  esp32HTTPrequest::_asyncSend(){
+    _seize;
+    DEBUG_HTTP("_asyncSend()\r\n");
+    _send(_requestBody, _requestLen);
+    _asyncPending = false;
+    _release;
+}
+
+//**************************************************************************************************************
 size_t  esp32HTTPrequest::_send(const char* body, size_t len){
     DEBUG_HTTP("_send() %d\r\n", len);
-    if(_HTTPmethod == HTTP_METHOD_POST){
-        _addHeader("Content-Length", String(len).c_str());
+    _stamp(_timings.sendStart);
+    if(_compress && _HTTPmethod == HTTP_METHOD_POST && len &&
+      (len == HTTP_REQUEST_CHUNKED || len >= ESP32_HTTP_REQUEST_GZIP_MIN)){
+        _compressBody(body, len);
+    }
+    if(len == HTTP_REQUEST_CHUNKED){
+        esp_http_client_delete_header(_client, "Content-Length");
     }
-    header* hdr = _headers;
-    while(hdr){
-        esp_http_client_set_header(_client, hdr->name, hdr->value);
-        hdr = hdr->next;
+    else if(_HTTPmethod == HTTP_METHOD_POST){
+        char value[12];
+        snprintf(value, sizeof(value), "%u", (unsigned) len);
+        _addHeader("Content-Length", value);
     }
-    delete _headers;
-    _headers = nullptr;
+    _requestBody = _requestBuf || _bodyProviderCB ? nullptr : body;
     _requestLen = len;
-    if(len){
-      esp_http_client_set_post_field(_client, body, len);
+    _requestSent = 0;
+    if(len && ! _requestBuf && ! _bodyProviderCB){
+        esp_http_client_set_post_field(_client, body, len);
     }
+    else {
+        esp_http_client_set_post_field(_client, nullptr, 0);
+    }
+
+            // Headers set in the client stay there until deleted, and the
+            // client may go to the pool for another instance. The request
+            // headers are kept in the arena until they have been deleted,
+            // the index is cleared for the response headers.
+
+    for(int i=0; i<_headerCount; i++){
+        esp_http_client_set_header(_client, _headerIndex[i]->name, _headerIndex[i]->value);
+    }
+    header** sentHeaders = _headerIndex;
+    uint16_t sentCount = _headerCount;
+    _headerClear();
     bool isTLS = strcmp(_URL->scheme, "HTTPS") == 0;
     if(isTLS){
+        portENTER_CRITICAL(&tlsMux);
+        if(_clientConnected){
+            tlsReusedCount++;
+        }
+        else {
+            tlsHandshakeCount++;
+        }
+        portEXIT_CRITICAL(&tlsMux);
         xSemaphoreTake(TLSlock_S, portMAX_DELAY);
     }
-    esp_err_t err;
-    do {
-        err = esp_http_client_perform(_client);
-    } while (err == ESP_ERR_HTTP_EAGAIN);
+    _stamp(_timings.lockAcquired);
+    bool reused = _clientConnected;
+    esp_err_t err = _perform();
+
+            // A kept-alive connection may have been closed by the server
+            // while idle. Retry once on a new connection, but only if
+            // nothing at all came back (the request most likely never
+            // reached the server) and the body can be sent again:
+            // contiguous and xbuf bodies are, a bodyProviderCB can't be rewound.
+
+    if(err != ESP_OK && reused && ! _respReceived && ! (_bodyProviderCB && _requestSent) && _client){
+        DEBUG_HTTP("reused connection failed, retry\r\n");
+        esp_http_client_close(_client);
+        _clientConnected = false;
+        _clientStreamed = false;
+        _requestSent = 0;
+        _responseReset();
+        if(isTLS){
+            portENTER_CRITICAL(&tlsMux);
+            tlsReusedCount--;
+            tlsHandshakeCount++;
+            portEXIT_CRITICAL(&tlsMux);
+        }
+        err = _perform();
+    }
     if(isTLS){
         xSemaphoreGive(TLSlock_S);
     }
+    if(_client){
+        for(int i=0; i<sentCount; i++){
+            esp_http_client_delete_header(_client, sentHeaders[i]->name);
+        }
+    }
     if(err != ESP_OK){
         _HTTPcode = HTTPCODE_PERFORM_FAILED;
         DEBUG_HTTP("perform failed  %s\r\n", esp_err_to_name(err));
         abort();
+        _stamp(_timings.finished);
         _setReadyState(readyStateDone);
     }
+    if(_requestBufOwned){
+        _deleteXbuf(_requestBuf);
+    }
+    else if(_requestBuf){
+        _requestBuf->consume(_requestLen);
+    }
+    _requestBuf = nullptr;
+    _requestBufOwned = false;
+    _requestBody = nullptr;
+    _compressEnd();
+    _requestString = String();
+    _bodyProviderCB = nullptr;
+    if( ! _holdClient){
+        _checkin();
+    }
     _lastActivity = millis(); 
+    if(timingsHook){
+        timingsHook(this, _timings);
+    }
     return len;
 }
 
+//**************************************************************************************************************
+bool    esp32HTTPrequest::_compressBody(const char* body, size_t& len){
+
+            // A bodyProviderCB body is compressed as it is pulled by
+            // _streamBody() and sent chunked, so it is never held whole.
+
+    if(_bodyProviderCB){
+        _gzipOut = _newXbuf(HTTP_REQUEST_MIN_RX_SEGMENT, HTTP_REQUEST_MAX_TX_BUFFER);
+        _gzip = new xgzip(_gzipOut, ESP32_HTTP_REQUEST_GZIP_WINDOW);
+        if( ! _gzip->ok()){
+            DEBUG_HTTP("_compressBody no memory\r\n");
+            _compressEnd();
+            return false;
+        }
+        _alloc(_gzip->memory());
+        _gzipDone = false;
+        _addHeader("Content-Encoding", "gzip");
+        len = HTTP_REQUEST_CHUNKED;
+        return true;
+    }
+
+            // A contiguous or xbuf body is already in memory. It is
+            // compressed into a new xbuf that then replaces it as an xbuf
+            // body. An xbuf body is read in place so that the original can
+            // still be sent if compression doesn't make it smaller.
+            // Returns true with len set to the compressed size
+            // if the body will be sent compressed.
+
+    xbuf* zbuf = _newXbuf(HTTP_REQUEST_MIN_RX_SEGMENT, HTTP_REQUEST_MAX_TX_BUFFER);
+    xgzip gzip(zbuf, ESP32_HTTP_REQUEST_GZIP_WINDOW);
+    if( ! gzip.ok()){
+        DEBUG_HTTP("_compressBody no memory\r\n");
+        _deleteXbuf(zbuf);
+        return false;
+    }
+    _alloc(gzip.memory());
+    if(_requestBuf){
+        xspan spans[4];
+        size_t offset = 0;
+        size_t count;
+        while(offset < len && (count = _requestBuf->spans(spans, 4, offset))){
+            for(size_t i=0; i<count && offset < len; i++){
+                size_t take = spans[i].len < len - offset ? spans[i].len : len - offset;
+                gzip.write(spans[i].data, take);
+                offset += take;
+            }
+        }
+    }
+    else {
+        gzip.write((const uint8_t*) body, len);
+    }
+    size_t zlen = gzip.finish();
+    _alloc(-(int32_t)gzip.memory());
+    DEBUG_HTTP("_compressBody %d -> %d\r\n", len, zlen);
+    if(zlen >= len || ! gzip.ok()){
+        _deleteXbuf(zbuf);
+        return false;
+    }
+    if(_requestBuf){
+        _requestBuf->consume(len);
+        if(_requestBufOwned){
+            _deleteXbuf(_requestBuf);
+        }
+    }
+    _requestBuf = zbuf;
+    _requestBufOwned = true;
+    _addHeader("Content-Encoding", "gzip");
+    len = zlen;
+    return true;
+}
+
+//**************************************************************************************************************
+int     esp32HTTPrequest::_gzipBody(uint8_t* data, size_t demand){
+
+            // Pull from the bodyProviderCB until there is a piece of
+            // compressed output to send. data is free for the raw body
+            // once it has been written to the compressor's window.
+            // Returns 0 when the body is complete, -1 if the compressor failed.
+
+    while(_gzipOut->available() < demand && ! _gzipDone){
+        size_t supply = _bodyProviderCB(_bodyProviderCBarg, this, data, demand);
+        if(supply > demand){
+            supply = demand;
+        }
+        if(supply){
+            _gzip->write(data, supply);
+        }
+        else {
+            _gzip->finish();
+            DEBUG_HTTP("_gzipBody %d -> %d\r\n", _gzip->in(), _gzip->out());
+            _gzipDone = true;
+        }
+        if( ! _gzip->ok()){
+            return -1;
+        }
+    }
+    return _gzipOut->read(data, demand);
+}
+
+//**************************************************************************************************************
+void    esp32HTTPrequest::_compressEnd(){
+    if(_gzip){
+        if(_gzip->ok()){
+            _alloc(-(int32_t)_gzip->memory());
+        }
+        delete _gzip;
+        _gzip = nullptr;
+    }
+    _deleteXbuf(_gzipOut);
+    _gzipOut = nullptr;
+}
+
+//**************************************************************************************************************
+esp_err_t  esp32HTTPrequest::_perform(){
+    esp_err_t err;
+    if( ! _requestBuf && ! _bodyProviderCB && ! _clientStreamed){
+        do {
+            err = esp_http_client_perform(_client);
+        } while (err == ESP_ERR_HTTP_EAGAIN);
+        return err;
+    }
+
+            // Stream an xbuf or bodyProviderCB body in HTTP_REQUEST_MAX_TX_BUFFER
+            // pieces so that heap use does not grow with the size of the body.
+            // The response is read to the end so the connection can be kept.
+            // esp_http_client_perform() can't follow open/write/read on the
+            // same connection, so later requests on it, whatever the body,
+            // come this way too (without perform's redirect and auth handling)
+            // until it is closed.
+
+    err = esp_http_client_open(_client, _requestLen);
+    if(err != ESP_OK){
+        return err;
+    }
+    char* buf = new char[HTTP_REQUEST_MAX_TX_BUFFER];
+    _alloc(HTTP_REQUEST_MAX_TX_BUFFER);
+    err = _streamBody(buf);
+    if(err == ESP_OK && esp_http_client_fetch_headers(_client) < 0){
+        err = ESP_FAIL;
+    }
+    int rlen = 0;
+    while(err == ESP_OK && (rlen = esp_http_client_read(_client, buf, HTTP_REQUEST_MAX_TX_BUFFER)) > 0);
+    if(rlen < 0){
+        err = ESP_FAIL;
+    }
+    delete[] buf;
+    _alloc(-HTTP_REQUEST_MAX_TX_BUFFER);
+    if(err == ESP_OK){
+        _onFinish();
+    }
+    if(err != ESP_OK || ! esp_http_client_is_complete_data_received(_client)){
+        esp_http_client_close(_client);
+        _clientConnected = false;
+    }
+    _clientStreamed = _clientConnected;
+    if(_requestLen < 0){
+        esp_http_client_delete_header(_client, "Transfer-Encoding");
+    }
+    return err;
+}
+
+//**************************************************************************************************************
+esp_err_t  esp32HTTPrequest::_streamBody(char* buf){
+
+            // When chunked, room is left in buf to frame each piece
+            // with its hex length and trailing CRLF, so it goes out in one write.
+            // A zero length piece is the terminating chunk.
+
+    bool chunked = _requestLen < 0;
+    char* data = chunked ? buf + 10 : buf;
+    size_t room = chunked ? HTTP_REQUEST_MAX_TX_BUFFER - 12 : HTTP_REQUEST_MAX_TX_BUFFER;
+    while(chunked || _requestSent < (size_t)_requestLen){
+
+            // A contiguous body and xbuf segments large enough to fill
+            // much of a packet are written in place. Smaller segments are
+            // gathered into buf to avoid tiny writes. The xbuf is read at
+            // _requestSent, not consumed, so the body can be sent again.
+
+        xspan span;
+        span.len = 0;
+        if(_requestBody){
+            span.data = (const uint8_t*) _requestBody + _requestSent;
+            span.len = _requestLen - _requestSent;
+        }
+        else if(_requestBuf && ! chunked){
+            _requestBuf->spans(&span, 1, _requestSent);
+        }
+        if(span.len >= HTTP_REQUEST_MAX_TX_BUFFER / 2 || _requestBody){
+            size_t chunk = _requestLen - _requestSent;
+            if(chunk > span.len){
+                chunk = span.len;
+            }
+            if(chunk > HTTP_REQUEST_MAX_TX_BUFFER){
+                chunk = HTTP_REQUEST_MAX_TX_BUFFER;
+            }
+            _requestSent += chunk;
+            if(esp_http_client_write(_client, (const char*)span.data, chunk) != (int)chunk){
+                return ESP_FAIL;
+            }
+            continue;
+        }
+        size_t demand = room;
+        if( ! chunked && demand > _requestLen - _requestSent){
+            demand = _requestLen - _requestSent;
+        }
+        size_t chunk = 0;
+        if(_requestBuf){
+            xspan spans[4];
+            size_t count = _requestBuf->spans(spans, 4, _requestSent);
+            for(size_t i=0; i<count && chunk < demand; i++){
+                size_t take = spans[i].len < demand - chunk ? spans[i].len : demand - chunk;
+                memcpy(data + chunk, spans[i].data, take);
+                chunk += take;
+            }
+        }
+        else if(_gzip){
+            int zlen = _gzipBody((uint8_t*)data, demand);
+            if(zlen < 0){
+                return ESP_FAIL;
+            }
+            chunk = zlen;
+        }
+        else {
+            chunk = _bodyProviderCB(_bodyProviderCBarg, this, (uint8_t*)data, demand);
+        }
+        if(chunk > demand){
+            chunk = demand;
+        }
+        _requestSent += chunk;
+        char* out = data;
+        size_t outLen = chunk;
+        if(chunked){
+            char size[12];
+            int sizeLen = sprintf(size, "%x\r\n", (unsigned)chunk);
+            out = data - sizeLen;
+            memcpy(out, size, sizeLen);
+            memcpy(data + chunk, "\r\n", 2);
+            outLen = sizeLen + chunk + 2;
+        }
+        else if( ! chunk){
+            DEBUG_HTTP("body short %d of %d\r\n", _requestSent, _requestLen);
+            return ESP_FAIL;
+        }
+        if(esp_http_client_write(_client, out, outLen) != (int)outLen){
+            return ESP_FAIL;
+        }
+        if( ! chunk){
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+//**************************************************************************************************************
+bool  esp32HTTPrequest::_checkout(const char* origin){
+    if(_clientOrigin){
+        _alloc(-(int32_t)(strlen(_clientOrigin) + 1));
+        delete[] _clientOrigin;
+    }
+    _clientOrigin = nullptr;
+    _clientURL = 0;
+    xSemaphoreTake(poolLock_S, portMAX_DELAY);
+    poolExpire();
+    for(int i=0; i<ESP32_HTTP_REQUEST_POOL_SIZE; i++){
+        poolEntry* entry = &connectionPool[i];
+        if(entry->client &&
+           strcmp(entry->origin, origin) == 0 &&
+           entry->cert == _cert_pem &&
+           entry->globalCA == _useGlobalCAStore){
+            _client = entry->client;
+            _clientConnected = entry->connected;
+            _clientStreamed = entry->streamed;
+            _clientURL = entry->URL;
+            _clientOrigin = entry->origin;
+            entry->client = nullptr;
+            entry->origin = nullptr;
+            poolRemove(entry);
+            break;
+        }
+    }
+    xSemaphoreGive(poolLock_S);
+    if( ! _clientOrigin){
+        _clientOrigin = new char[strlen(origin) + 1];
+        strcpy(_clientOrigin, origin);
+    }
+    _alloc(strlen(_clientOrigin) + 1);
+    return _client != nullptr;
+}
+
+//**************************************************************************************************************
+void  esp32HTTPrequest::_checkin(){
+    if( ! _client) return;
+    xSemaphoreTake(poolLock_S, portMAX_DELAY);
+    poolExpire();
+    if(_clientConnected && strncmp(_clientOrigin, "HTTPS:", 6) == 0){
+        poolLimitTLS(ESP32_HTTP_REQUEST_MAX_TLS - 1);
+    }
+    int sameOrigin = 0;
+    poolEntry* slot = nullptr;
+    for(int i=0; i<ESP32_HTTP_REQUEST_POOL_SIZE; i++){
+        poolEntry* entry = &connectionPool[i];
+        if( ! entry->client){
+            if( ! slot || slot->client) slot = entry;
+        }
+        else {
+            if(strcmp(entry->origin, _clientOrigin) == 0) sameOrigin++;
+            if( ! slot || (slot->client && entry->lastUsed < slot->lastUsed)) slot = entry;
+        }
+    }
+    if(sameOrigin >= ESP32_HTTP_REQUEST_POOL_PER_HOST || ! slot){
+        esp_http_client_cleanup(_client);
+    }
+    else {
+        if(slot->client){
+            poolRemove(slot);
+        }
+        esp_http_client_set_user_data(_client, nullptr);
+        slot->client = _client;
+        slot->origin = _clientOrigin;
+        slot->cert = _cert_pem;
+        slot->globalCA = _useGlobalCAStore;
+        slot->connected = _clientConnected;
+        slot->streamed = _clientStreamed;
+        slot->URL = _clientURL;
+        _alloc(-(int32_t)(strlen(_clientOrigin) + 1));
+        slot->lastUsed = millis();
+        _clientOrigin = nullptr;
+    }
+    xSemaphoreGive(poolLock_S);
+    _client = nullptr;
+    _clientConnected = false;
+    _clientStreamed = false;
+}
+
 //**************************************************************************************************************
 void  esp32HTTPrequest::_setReadyState(readyStates newState){
     if(_readyState != newState){
@@ -342,12 +1254,77 @@ void  esp32HTTPrequest::_setReadyState(readyStates newState){
     } 
 }
 
+//**************************************************************************************************************
+void  esp32HTTPrequest::_stamp(uint32_t& mark){
+    if( ! mark){
+        mark = micros() - _timings.start;
+    }
+}
+
+//**************************************************************************************************************
+void  esp32HTTPrequest::_alloc(int32_t bytes){
+    portENTER_CRITICAL(&allocMux);
+    if(bytes > 0){
+        _allocs.count++;
+        _allocs.bytes += bytes;
+        allocTotal.count++;
+        allocTotal.bytes += bytes;
+    }
+    _allocs.held += bytes;
+    allocTotal.held += bytes;
+    if(_allocs.held > _allocs.peak){
+        _allocs.peak = _allocs.held;
+    }
+    if(allocTotal.held > allocTotal.peak){
+        allocTotal.peak = allocTotal.held;
+    }
+    portEXIT_CRITICAL(&allocMux);
+}
+
+//**************************************************************************************************************
+void  esp32HTTPrequest::_xbufAlloc(void* arg, int32_t bytes){
+    ((esp32HTTPrequest*) arg)->_alloc(bytes);
+}
+
+//**************************************************************************************************************
+xbuf*  esp32HTTPrequest::_newXbuf(size_t segSize, size_t maxSegSize){
+    xbuf* buf = new xbuf(segSize, maxSegSize);
+    _alloc(sizeof(xbuf));
+    buf->onAlloc(_xbufAlloc, this);
+    return buf;
+}
+
+//**************************************************************************************************************
+void  esp32HTTPrequest::_deleteXbuf(xbuf* buf){
+    if(buf){
+        delete buf;
+        _alloc(-(int32_t)sizeof(xbuf));
+    }
+}
+
 //**************************************************************************************************************
 bool  esp32HTTPrequest::_parseURL(const char* url){
-    delete _URL;
-    _URL = new URL;
-    _URL->buffer = new char[strlen(url) + 8];
-    char *bufptr = _URL->buffer;
+    if( ! _URL){
+        _URL = new URL;
+        _alloc(sizeof(URL));
+    }
+
+        // Source, components (+ default scheme and delimiters) and origin
+
+    size_t len = strlen(url);
+    size_t size = len * 3 + 24;
+    if(size > _URL->size){
+        if(_URL->buffer != _URL->storage){
+            _alloc(-(int32_t)_URL->size);
+            delete[] _URL->buffer;
+        }
+        _URL->buffer = new char[size];
+        _URL->size = size;
+        _alloc(size);
+    }
+    _URL->url = _URL->buffer;
+    memcpy(_URL->url, url, len + 1);
+    char *bufptr = _URL->buffer + len + 1;
     const char *urlptr = url;
 
         // Find first delimiter
@@ -357,7 +1334,7 @@ bool  esp32HTTPrequest::_parseURL(const char* url){
         // scheme
 
     _URL->scheme = bufptr;
-    if(! memcmp(urlptr+seglen, "://", 3)){
+    if(! strncmp(urlptr+seglen, "://", 3)){
         while(seglen--){
             *bufptr++ = toupper(*urlptr++);
         }
@@ -413,6 +1390,14 @@ bool  esp32HTTPrequest::_parseURL(const char* url){
     }
     *bufptr++ = 0;
 
+        // origin
+
+    _URL->origin = bufptr;
+    sprintf(bufptr, "%s://%s:%s", _URL->scheme, _URL->host, _URL->port);
+    xSemaphoreTake(poolLock_S, portMAX_DELAY);
+    _URL->serial = ++URLserial;
+    xSemaphoreGive(poolLock_S);
+
     DEBUG_HTTP("_parseURL() %s://%s:%s%s%.32s\r\n", _URL->scheme, _URL->host, _URL->port, _URL->path, _URL->query);
     return true;
 }
@@ -432,6 +1417,7 @@ ________________________________________________________________________________
 esp_err_t http_event_handle(esp_http_client_event_t *evt)
 {
     esp32HTTPrequest *_this = (esp32HTTPrequest*)evt->user_data;
+    if( ! _this) return ESP_OK;                     // Idle in connection pool
     return _this->_http_event_handle(evt);
 }
 
@@ -443,75 +1429,170 @@ esp_err_t esp32HTTPrequest::_http_event_handle(esp_http_client_event_t * evt)
             break;
         case HTTP_EVENT_ON_CONNECTED:
             DEBUG_HTTP("client connected event\n");
+            _stamp(_timings.connected);
+            _clientConnected = true;
             _setReadyState(readyStateOpened);
             break;
         case HTTP_EVENT_HEADER_SENT:
             DEBUG_HTTP("headers sent event\n");
+            _stamp(_timings.headersSent);
             break;
         case HTTP_EVENT_ON_HEADER:
             DEBUG_HTTP("header received event %s:%s\n", evt->header_key, evt->header_value);
-            _addHeader(evt->header_key, evt->header_value);
+            _stamp(_timings.firstHeader);
+            _respReceived = true;
+            _addRespHeader(evt->header_key, evt->header_value);
             break;
         case HTTP_EVENT_ON_DATA:
             DEBUG_HTTP("on-data event, len=%d\n", evt->data_len);
-            _setReadyState(readyStateHdrsRecvd);
+            _stamp(_timings.firstData);
+            _respReceived = true;
+            if(_readyState < readyStateHdrsRecvd){
+                _setReadyState(readyStateHdrsRecvd);
+            }
             _onData(evt->data, evt->data_len);
             break;
         case HTTP_EVENT_DISCONNECTED:
             DEBUG_HTTP("disconnect event\n");
+            _clientConnected = false;
+            _clientStreamed = false;
             break;
         case HTTP_EVENT_ON_FINISH:
             DEBUG_HTTP("client finish event\n");
-            _HTTPcode = esp_http_client_get_status_code(_client);
-            _setReadyState(readyStateDone);
-            delete _request;
-            _request = nullptr;
-            // String connection = respHeaderValue("connection");
-            // if(!connection.equalsIgnoreCase("keep-alive")){
-            //     esp_http_client_close(_client); 
-            // }
-            while(_onDataCB && _response->available()){
-                _lastActivity = millis(); 
-                _onDataCB(_onDataCBarg, this, available());
-            }
+            _onFinish();
             break;
     }
     return ESP_OK;
 }
 
+//**************************************************************************************************************
+void  esp32HTTPrequest::_onFinish(){
+    _stamp(_timings.finished);
+    _HTTPcode = esp_http_client_get_status_code(_client);
+    if(_sinkFailed){
+        _HTTPcode = HTTPCODE_STREAM_WRITE;
+    }
+    if(_rxOverflow){
+        _HTTPcode = HTTPCODE_TOO_LESS_RAM;
+    }
+    _setReadyState(readyStateDone);
+    if(_respClose){
+        esp_http_client_close(_client); 
+        _clientConnected = false;
+    }
+    while(_onDataCB && available()){
+        _lastActivity = millis(); 
+        _onDataCB(_onDataCBarg, this, available());
+    }
+}
+
 //**************************************************************************************************************
 void  esp32HTTPrequest::_onData(void* Vbuf, size_t len){
     DEBUG_HTTP("_onData handler %.16s... (%d)\r\n",(char*) Vbuf, len);
     _seize;
     _lastActivity = millis();
 
+
+                // The response buffer and its counts are also read by the
+                // application, possibly in another task, under bufferLock
+                // rather than threadLock, which send() holds throughout.
+
+    _seizeBuffer;
     if(!_chunked && esp_http_client_is_chunked_response(_client)){
         _chunked = true;
         DEBUG_HTTP("Response is chunked.\n");
     } 
+
+                // With a sink, data goes straight from the client's
+                // buffer to the sink without being buffered here.
+
+    if(_sinkCB || _sinkPrint){
+        if(_readyState < readyStateLoading){
+            _contentRead = 0;
+            _contentLength = _chunked ? 0 : esp_http_client_get_content_length(_client);
+        }
+        if(_chunked){
+            _contentLength += len;
+        }
+        _releaseBuffer;
+        if(_readyState != readyStateDone){
+            _setReadyState(readyStateLoading);
+        }
+        _release;
+        _toSink((uint8_t*)Vbuf, len);
+        return;
+    }
               
     if(! _response){
-        _response = new xbuf;
         _contentRead = 0;
         if (_chunked){
             _contentLength = 0;
         }
         else {
             _contentLength = esp_http_client_get_content_length(_client);
+        }
+
+                // Size xbuf segments to the response. A known length uses
+                // segments of that length up to HTTP_REQUEST_MAX_RX_SEGMENT,
+                // otherwise segments grow from HTTP_REQUEST_MIN_RX_SEGMENT.
+                // Both are powers of two, so with xbuf::segPool() enabled
+                // response segments fall in its size classes and are recycled.
+
+        if(! _chunked && (int)_contentLength > 0){
+            _response = _newXbuf(_contentLength < HTTP_REQUEST_MAX_RX_SEGMENT ? _contentLength : HTTP_REQUEST_MAX_RX_SEGMENT);
+        }
+        else {
+            _response = _newXbuf(HTTP_REQUEST_MIN_RX_SEGMENT, HTTP_REQUEST_MAX_RX_SEGMENT);
         }
     }
     
+                // If the buffer is at its limit, stall the read until
+                // the application (in another task) reads some of it.
+                // Only bufferLock is let go, so the application can read.
+                // Not reading from the connection applies TCP backpressure
+                // to the sender. If there's no progress within _timeout,
+                // the rest of the response is discarded.
+
+    uint32_t progress = millis();
+    size_t level = _response->available();
+    while(_maxBuffer && level && (level + len) > _maxBuffer && ! _rxOverflow){
+        _releaseBuffer;
+        vTaskDelay(1);
+        _seizeBuffer;
+        if(_response->available() < level){
+            progress = millis();
+        }
+        level = _response->available();
+        if((millis() - progress) > _timeout * 1000){
+            DEBUG_HTTP("response buffer full, response discarded\r\n");
+            _rxOverflow = true;
+        }
+    }
+    if(_rxOverflow){
+        _releaseBuffer;
+        _release;
+        return;
+    }
+
                 // Transfer data to xbuf
 
-    _response->write((uint8_t*)Vbuf, len);
+    if(_response->write((uint8_t*)Vbuf, len) != len){
+        DEBUG_HTTP("no memory for response, response discarded\r\n");
+        _rxOverflow = true;
+    }
     if(_chunked){
         _contentLength += len;
     }
+    if(_response->available() > _peakBuffered){
+        _peakBuffered = _response->available();
+    }
+    bool buffered = _response->available();
+    _releaseBuffer;
 
                 // If there's data in the buffer and not Done,
                 // advance readyState to Loading.
 
-    if(_response->available() && _readyState != readyStateDone){
+    if(buffered && _readyState != readyStateDone){
         _setReadyState(readyStateLoading);
     }
 
@@ -524,6 +1605,38 @@ void  esp32HTTPrequest::_onData(void* Vbuf, size_t len){
     }
 }
 
+//**************************************************************************************************************
+void  esp32HTTPrequest::_toSink(const uint8_t* data, size_t len){
+
+                // The sink may accept less than offered.
+                // Keep offering the rest, which stalls the read and
+                // so the sender, until it's all taken or _timeout passes
+                // without progress. Then discard the rest of the response.
+
+    uint32_t progress = millis();
+    while(len && ! _sinkFailed){
+        size_t accepted = _sinkCB ? _sinkCB(_sinkCBarg, this, data, len) : _sinkPrint->write(data, len);
+        if(accepted > len){
+            accepted = len;
+        }
+        data += accepted;
+        len -= accepted;
+        _seizeBuffer;
+        _contentRead += accepted;
+        _releaseBuffer;
+        if(accepted){
+            progress = millis();
+        }
+        else if((millis() - progress) > _timeout * 1000){
+            DEBUG_HTTP("sink stalled, response discarded\r\n");
+            _sinkFailed = true;
+        }
+        else {
+            vTaskDelay(1);
+        }
+    }
+}
+
 /*_____________________________________________________________________________________________________________
 
                         H   H  EEEEE   AAA   DDDD   EEEEE  RRRR    SSS
@@ -535,66 +1648,54 @@ ________________________________________________________________________________
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const char* name, const char* value){
-    if(_readyState <= readyStateOpened && _headers){
+    if(_readyState <= readyStateOpened && _headerCount){
         _addHeader(name, value);
     }
 }
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const char* name, const __FlashStringHelper* value){
-    if(_readyState <= readyStateOpened && _headers){
-        char* _value = _charstar(value);
-        _addHeader(name, _value);
-        delete[] _value;
+    if(_readyState <= readyStateOpened && _headerCount){
+        _addHeader(name, (const char*) value, true, false);
     }
 }
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const __FlashStringHelper *name, const char* value){
-    if(_readyState <= readyStateOpened && _headers){
-        char* _name = _charstar(name);
-        _addHeader(_name, value);
-        delete[] _name;
+    if(_readyState <= readyStateOpened && _headerCount){
+        _addHeader((const char*) name, value, false, true);
     }
 }
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const __FlashStringHelper *name, const __FlashStringHelper* value){
-    if(_readyState <= readyStateOpened && _headers){
-        char* _name = _charstar(name);
-        char* _value = _charstar(value);
-        _addHeader(_name, _value);
-        delete[] _name;
-        delete[] _value;
+    if(_readyState <= readyStateOpened && _headerCount){
+        _addHeader((const char*) name, (const char*) value, false, false);
     }
 }
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const char* name, int32_t value){
-    if(_readyState <= readyStateOpened && _headers){
-        setReqHeader(name, String(value).c_str());
+    if(_readyState <= readyStateOpened && _headerCount){
+        char _value[12];
+        snprintf(_value, sizeof(_value), "%ld", (long) value);
+        _addHeader(name, _value);
     }
 }
 
 //**************************************************************************************************************
 void	esp32HTTPrequest::setReqHeader(const __FlashStringHelper *name, int32_t value){
-    if(_readyState <= readyStateOpened && _headers){
-        char* _name = _charstar(name);
-        setReqHeader(_name, String(value).c_str());
-        delete[] _name;
+    if(_readyState <= readyStateOpened && _headerCount){
+        char _value[12];
+        snprintf(_value, sizeof(_value), "%ld", (long) value);
+        _addHeader((const char*) name, _value, false, true);
     }
 }
 
 //**************************************************************************************************************
 int		esp32HTTPrequest::respHeaderCount(){
     if(_readyState < readyStateHdrsRecvd) return 0;                                            
-    int count = 0;
-    header* hdr = _headers;
-    while(hdr){
-        count++;
-        hdr = hdr->next;
-    }
-    return count;
+    return _headerCount;
 }
 
 //**************************************************************************************************************
@@ -602,7 +1703,7 @@ char*   esp32HTTPrequest::respHeaderName(int ndx){
     if(_readyState < readyStateHdrsRecvd) return nullptr;      
     header* hdr = _getHeader(ndx);
     if ( ! hdr) return nullptr;
-    return hdr->name;
+    return (char*) hdr->name;
 }
 
 //**************************************************************************************************************
@@ -610,17 +1711,15 @@ char*   esp32HTTPrequest::respHeaderValue(const char* name){
     if(_readyState < readyStateHdrsRecvd) return nullptr;      
     header* hdr = _getHeader(name);
     if( ! hdr) return nullptr;
-    return hdr->value;
+    return (char*) hdr->value;
 }
 
 //**************************************************************************************************************
 char*   esp32HTTPrequest::respHeaderValue(const __FlashStringHelper *name){
     if(_readyState < readyStateHdrsRecvd) return nullptr;
-    char* _name = _charstar(name);      
-    header* hdr = _getHeader(_name);
-    delete[] _name;
+    header* hdr = _getHeader((const char*) name);
     if( ! hdr) return nullptr;
-    return hdr->value;
+    return (char*) hdr->value;
 }
 
 //**************************************************************************************************************
@@ -628,7 +1727,7 @@ char*   esp32HTTPrequest::respHeaderValue(int ndx){
     if(_readyState < readyStateHdrsRecvd) return nullptr;      
     header* hdr = _getHeader(ndx);
     if ( ! hdr) return nullptr;
-    return hdr->value;
+    return (char*) hdr->value;
 }
 
 //**************************************************************************************************************
@@ -642,9 +1741,7 @@ bool	esp32HTTPrequest::respHeaderExists(const char* name){
 //**************************************************************************************************************
 bool	esp32HTTPrequest::respHeaderExists(const __FlashStringHelper *name){
     if(_readyState < readyStateHdrsRecvd) return false;
-    char* _name = _charstar(name);      
-    header* hdr = _getHeader(_name);
-    delete[] _name;
+    header* hdr = _getHeader((const char*) name);
     if ( ! hdr) return false;
     return true;
 }
@@ -653,13 +1750,11 @@ bool	esp32HTTPrequest::respHeaderExists(const __FlashStringHelper *name){
 String  esp32HTTPrequest::headers(){
     _seize;
     String _response = "";
-    header* hdr = _headers;
-    while(hdr){
-        _response += hdr->name;
+    for(int i=0; i<_headerCount; i++){
+        _response += _headerIndex[i]->name;
         _response += ':';
-        _response += hdr->value;
+        _response += _headerIndex[i]->value;
         _response += "\r\n";
-        hdr = hdr->next;
     }
     _response += "\r\n";
     _release;
@@ -667,58 +1762,241 @@ String  esp32HTTPrequest::headers(){
 }
 
 //**************************************************************************************************************
-esp32HTTPrequest::header*  esp32HTTPrequest::_addHeader(const char* name, const char* value){
+const char* esp32HTTPrequest::respContentType(){
+    if(_readyState < readyStateHdrsRecvd) return nullptr;
+    return _respContentType;
+}
+
+//**************************************************************************************************************
+int32_t esp32HTTPrequest::respContentLength(){
+    if(_readyState < readyStateHdrsRecvd) return -1;
+    return _respContentLength;
+}
+
+//**************************************************************************************************************
+const char* esp32HTTPrequest::respETag(){
+    if(_readyState < readyStateHdrsRecvd) return nullptr;
+    return _respETag;
+}
+
+//**************************************************************************************************************
+bool    esp32HTTPrequest::respKeepAlive(){
+    return ! _respClose;
+}
+
+//**************************************************************************************************************
+esp32HTTPrequest::header*  esp32HTTPrequest::_addHeader(const char* name, const char* value, bool copyName, bool copyValue, bool repeat){
     _seize;
-    header* hdr = (header*) &_headers;
-    while(hdr->next) {
-        if(strcasecmp(name, hdr->next->name) == 0){
-            header* oldHdr = hdr->next;
-            hdr->next = hdr->next->next;
-            oldHdr->next = nullptr;
-            delete oldHdr;
+    uint32_t hash = _headerHashOf(name);
+    header** bucket = &_headerHash[hash & (ESP32_HTTP_REQUEST_HEADER_BUCKETS - 1)];
+    for(header* hdr = *bucket; hdr; hdr = hdr->chain){
+        if(repeat){
+            bucket = &hdr->chain;                   // A repeat is linked last, lookup finds the first
+        }
+        else if(hdr->hash == hash && strcasecmp(name, hdr->name) == 0){
+            const char* newValue = copyValue ? _headerString(value) : value;
+            if(newValue){
+                hdr->value = newValue;              // Old value is reclaimed by _headerReset()
+            }
+            _release;
+            return newValue ? hdr : nullptr;
+        }
+    }
+    if(_headerCount == _headerIndexSize){
+        uint16_t size = _headerIndexSize ? _headerIndexSize * 2 : 16;
+        header** index = (header**) _headerAlloc(size * sizeof(header*));
+        if( ! index){
+            _release;
+            return nullptr;
+        }
+        if(_headerCount){
+            memcpy(index, _headerIndex, _headerCount * sizeof(header*));
+        }
+        _headerIndex = index;
+        _headerIndexSize = size;
+    }
+    header* newHdr = (header*) _headerAlloc(sizeof(header));
+    if(newHdr){
+        newHdr->hash = hash;
+        newHdr->name = copyName ? _headerString(name) : name;
+        newHdr->value = copyValue ? _headerString(value) : value;
+        if(newHdr->name && newHdr->value){
+            newHdr->chain = *bucket;
+            *bucket = newHdr;
+            _headerIndex[_headerCount++] = newHdr;
         }
         else {
-            hdr = hdr->next;
+            newHdr = nullptr;
         }
     }
-    hdr->next = new header;
-    hdr->next->name = new char[strlen(name)+1];
-    strcpy(hdr->next->name, name);
-    hdr->next->value = new char[strlen(value)+1];
-    strcpy(hdr->next->value, value);
     _release;
-    return hdr->next;
+    return newHdr;
 }
 
 //**************************************************************************************************************
-esp32HTTPrequest::header* esp32HTTPrequest::_getHeader(const char* name){
+void    esp32HTTPrequest::_addRespHeader(const char* name, const char* value){
+
+            // Connection and Content-Length are parsed even when the
+            // header is not kept, everything else is dropped without
+            // allocating if not in the keepRespHeaders() list.
+
+    if(strcasecmp(name, "connection") == 0){
+        _respClose = strcasecmp(value, "close") == 0;
+    }
+    else if(strcasecmp(name, "content-length") == 0){
+        _respContentLength = strtol(value, nullptr, 10);
+    }
+    else if(strcasecmp(name, "location") == 0){
+        _clientURL = 0;                             // redirect may have changed client URL
+    }
+    if(_keepCount){
+        uint32_t hash = _headerHashOf(name);
+        int i = 0;
+        while(i < _keepCount && (_keepHashes[i] != hash || strcasecmp(name, _keepHeaders[i]) != 0)) i++;
+        if(i == _keepCount){
+            DEBUG_HTTP("header %s dropped\r\n", name);
+            return;
+        }
+    }
+
+            // A repeated header is joined to the first as a comma separated
+            // list (RFC 9110 5.3), except Set-Cookie, which can't be joined
+            // and is kept as another header of the same name.
+
     _seize;
-    header* hdr = _headers;
-    while (hdr) {
-        if(strcasecmp(name, hdr->name) == 0) break;
-        hdr = hdr->next;
+    header* hdr = nullptr;
+    if(strcasecmp(name, "set-cookie") == 0){
+        hdr = _addHeader(name, value, true, true, true);
+    }
+    else if((hdr = _getHeader(name))){
+        size_t firstLen = strlen(hdr->value);
+        size_t len = strlen(value);
+        char* joined = (char*) _headerAlloc(firstLen + 2 + len + 1);
+        if(joined){
+            memcpy(joined, hdr->value, firstLen);
+            memcpy(joined + firstLen, ", ", 2);
+            memcpy(joined + firstLen + 2, value, len + 1);
+            hdr->value = joined;                    // First value is reclaimed by _headerReset()
+        }
+        else {
+            hdr = nullptr;
+        }
+    }
+    else {
+        hdr = _addHeader(name, value);
     }
     _release;
-    return hdr;
+    if( ! hdr) return;
+    if(strcasecmp(name, "content-type") == 0){
+        _respContentType = hdr->value;
+    }
+    else if(strcasecmp(name, "etag") == 0){
+        _respETag = hdr->value;
+    }
 }
 
 //**************************************************************************************************************
-esp32HTTPrequest::header* esp32HTTPrequest::_getHeader(int ndx){
+uint32_t esp32HTTPrequest::_headerHashOf(const char* name){
+    uint32_t hash = 2166136261UL;                   // FNV-1a of lower-cased name
+    while(*name){
+        hash = (hash ^ (uint8_t) tolower(*name++)) * 16777619UL;
+    }
+    return hash;
+}
+
+//**************************************************************************************************************
+void*   esp32HTTPrequest::_headerAlloc(size_t len){
+    len = (len + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    headerBlock* block = _headerArena;
+    while(block && block->size - block->used < len){
+        block = block->next;
+    }
+    if( ! block){
+        size_t size = len > ESP32_HTTP_REQUEST_HEADER_BLOCK ? len : ESP32_HTTP_REQUEST_HEADER_BLOCK;
+        block = (headerBlock*) malloc(sizeof(headerBlock) + size);
+        if( ! block) return nullptr;
+        _alloc(sizeof(headerBlock) + size);
+        block->size = size;
+        block->used = 0;
+        block->next = _headerArena;
+        _headerArena = block;
+    }
+    void* ptr = block->data + block->used;
+    block->used += len;
+    return ptr;
+}
+
+//**************************************************************************************************************
+const char* esp32HTTPrequest::_headerString(const char* str){
+    size_t len = strlen(str) + 1;
+    char* ptr = (char*) _headerAlloc(len);
+    if(ptr){
+        memcpy(ptr, str, len);
+    }
+    return ptr;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPrequest::_headerReset(){
+    _seize;
+    _headerClear();
+    for(headerBlock* block = _headerArena; block; block = block->next){
+        block->used = 0;
+    }
+    _release;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPrequest::_headerClear(){
+    _seize;
+    _headerIndex = nullptr;
+    _headerCount = 0;
+    _headerIndexSize = 0;
+    memset(_headerHash, 0, sizeof(_headerHash));
+    _respContentType = nullptr;
+    _respETag = nullptr;
+    _respContentLength = -1;
+    _respClose = false;
+    _release;
+}
+
+//**************************************************************************************************************
+void    esp32HTTPrequest::_responseReset(){
     _seize;
-    header* hdr = _headers;
+    _headerClear();
+    _seizeBuffer;
+    _deleteXbuf(_response);
+    _response = nullptr;
+    _chunked = false;
+    _contentRead = 0;
+    _contentLength = 0;
+    _releaseBuffer;
+    _sinkFailed = false;
+    _rxOverflow = false;
+    _respReceived = false;
+    _peakBuffered = 0;
+    _release;
+}
+
+//**************************************************************************************************************
+esp32HTTPrequest::header* esp32HTTPrequest::_getHeader(const char* name){
+    _seize;
+    uint32_t hash = _headerHashOf(name);
+    header* hdr = _headerHash[hash & (ESP32_HTTP_REQUEST_HEADER_BUCKETS - 1)];
     while (hdr) {
-        if( ! ndx--) break;
-        hdr = hdr->next; 
+        if(hdr->hash == hash && strcasecmp(name, hdr->name) == 0) break;
+        hdr = hdr->chain;
     }
     _release;
     return hdr;
 }
 
 //**************************************************************************************************************
-char* esp32HTTPrequest::_charstar(const __FlashStringHelper * str){
-  if( ! str) return nullptr;
-  char* ptr = new char[strlen_P((PGM_P)str)+1];
-  strcpy_P(ptr, (PGM_P)str);
-  return ptr;
+esp32HTTPrequest::header* esp32HTTPrequest::_getHeader(int ndx){
+    _seize;
+    header* hdr = (ndx >= 0 && ndx < _headerCount) ? _headerIndex[ndx] : nullptr;
+    _release;
+    return hdr;
 }
 
+
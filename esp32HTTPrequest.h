@@ -29,20 +29,46 @@
 
 #define _seize xSemaphoreTakeRecursive(threadLock,portMAX_DELAY)
 #define _release xSemaphoreGiveRecursive(threadLock)
+#define _seizeBuffer xSemaphoreTakeRecursive(bufferLock,portMAX_DELAY)
+#define _releaseBuffer xSemaphoreGiveRecursive(bufferLock)
 
 #include <pgmspace.h>
 #include <functional>
+#include <initializer_list>
 #include <xbuf.h>
+#include <xgzip.h>
 #include "esp_HTTP_client.h"
 
 
+// ESP32_HTTP_REQUEST_LOG selects how DEBUG_HTTP statements are compiled:
+//  0 - removed, their arguments are never evaluated.
+//  1 - trace, when debug is on the format and arguments are saved unformatted in a
+//      ring buffer of ESP32_HTTP_REQUEST_TRACE_DEPTH entries and printed by dumpTrace().
+//  2 - printed to DEBUG_IOTA_PORT when debug is on (default).
+
+#ifndef ESP32_HTTP_REQUEST_LOG
+  #define ESP32_HTTP_REQUEST_LOG 2
+#endif
+#ifndef ESP32_HTTP_REQUEST_TRACE_DEPTH
+  #define ESP32_HTTP_REQUEST_TRACE_DEPTH 64
+#endif
+
+#if ESP32_HTTP_REQUEST_LOG == 0
+#define DEBUG_HTTP(format,...)
+#elif ESP32_HTTP_REQUEST_LOG == 1
+#define DEBUG_HTTP(format,...)  if(_debug){_trace(PSTR(format),##__VA_ARGS__);}
+#else
 #define DEBUG_HTTP(format,...)  if(_debug){\
                                     DEBUG_IOTA_PORT.printf("Debug(%3ld): ", millis()-_requestStartTime);\
                                     DEBUG_IOTA_PORT.printf_P(PSTR(format),##__VA_ARGS__);}
+#endif
 
 #define DEFAULT_RX_TIMEOUT 3                    // Seconds for timeout
 #define HTTP_REQUEST_MAX_RX_BUFFER 1440
+#define HTTP_REQUEST_MIN_RX_SEGMENT 256         // Initial response xbuf segment when length unknown
+#define HTTP_REQUEST_MAX_RX_SEGMENT 2048        // Largest response xbuf segment, a power of two for xbuf::segPool()
 #define HTTP_REQUEST_MAX_TX_BUFFER 1440
+#define HTTP_REQUEST_CHUNKED ((size_t)-1)       // send(bodyProviderCB) length unknown, use chunked encoding
 
 #define HTTPCODE_CONNECTION_REFUSED  (-1)
 #define HTTPCODE_SEND_HEADER_FAILED  (-2)
@@ -62,38 +88,97 @@
   #define ESP32_HTTP_REQUEST_MAX_TLS 1
 #endif
 
+#ifndef ESP32_HTTP_REQUEST_ASYNC_TASKS
+  #define ESP32_HTTP_REQUEST_ASYNC_TASKS 2            // Worker tasks servicing async requests
+#endif
+#ifndef ESP32_HTTP_REQUEST_ASYNC_QUEUE
+  #define ESP32_HTTP_REQUEST_ASYNC_QUEUE 8            // Max async requests waiting for a worker
+#endif
+#ifndef ESP32_HTTP_REQUEST_ASYNC_STACK
+  #define ESP32_HTTP_REQUEST_ASYNC_STACK 8192         // Stack size of each worker task
+#endif
+#ifndef ESP32_HTTP_REQUEST_ASYNC_PRIORITY
+  #define ESP32_HTTP_REQUEST_ASYNC_PRIORITY 1
+#endif
+
+#ifndef ESP32_HTTP_REQUEST_POOL_SIZE
+  #define ESP32_HTTP_REQUEST_POOL_SIZE 4              // Idle connections kept for reuse by any instance
+#endif
+#ifndef ESP32_HTTP_REQUEST_POOL_PER_HOST
+  #define ESP32_HTTP_REQUEST_POOL_PER_HOST 2          // Idle connections kept per scheme/host/port
+#endif
+#ifndef ESP32_HTTP_REQUEST_POOL_IDLE_MS
+  #define ESP32_HTTP_REQUEST_POOL_IDLE_MS 30000       // Idle connections are closed after this, by the next request or closeIdle()
+#endif
+#ifndef ESP32_HTTP_REQUEST_HEADER_BLOCK
+  #define ESP32_HTTP_REQUEST_HEADER_BLOCK 512         // Header arena allocation unit, kept across open()
+#endif
+#ifndef ESP32_HTTP_REQUEST_GZIP_MIN
+  #define ESP32_HTTP_REQUEST_GZIP_MIN 512             // compress(true) leaves smaller bodies as is
+#endif
+#ifndef ESP32_HTTP_REQUEST_GZIP_WINDOW
+  #define ESP32_HTTP_REQUEST_GZIP_WINDOW 2048         // Compression window, working memory is 4x + 2K
+#endif
+#ifndef ESP32_HTTP_REQUEST_URL_INLINE
+  #define ESP32_HTTP_REQUEST_URL_INLINE 200           // URL parse storage without heap (~60 char URL)
+#endif
+#ifndef ESP32_HTTP_REQUEST_KEEP_HEADERS
+  #define ESP32_HTTP_REQUEST_KEEP_HEADERS 8           // Max names in keepRespHeaders() allowlist
+#endif
+#ifndef ESP32_HTTP_REQUEST_HEADER_BUCKETS
+  #define ESP32_HTTP_REQUEST_HEADER_BUCKETS 16        // Header name hash table size (power of 2)
+#endif
+
 esp_err_t http_event_handle(esp_http_client_event_t *evt);
 
 extern SemaphoreHandle_t TLSlock_S;
+extern QueueHandle_t asyncQueue_Q;
+extern SemaphoreHandle_t poolLock_S;
 
 class esp32HTTPrequest {
 
+        // Headers and their strings are carved from a chain of arena blocks
+        // that are reset, not freed, by open() and again when the request
+        // headers have been handed to the client. Each header is listed in
+        // arrival order in _headerIndex and chained into a hash bucket
+        // by its lower-cased name.
+
   struct header {
-	  header*	 	next;
-	  char*			name;
-	  char*			value;
-	  header():
-        next(nullptr), 
-        name(nullptr), 
-        value(nullptr)
-        {};
-	  ~header()
-    {
-        delete[] name; 
-        delete[] value; 
-        delete next;
-    }
+	  header*	 	chain;                      // next in hash bucket
+	  uint32_t      hash;
+	  const char*	name;
+	  const char*	value;
+  };
+
+  struct headerBlock {
+      headerBlock*  next;
+      size_t        size;
+      size_t        used;
+      char          data[];
   };
 
+        // Parsed URL is kept for the life of the request object. The source
+        // URL is saved so open() with the same URL skips the parse.
+        // Storage is inline, or on the heap for a URL that doesn't fit.
+
   struct  URL {
       char *buffer;
+      size_t size;
+      uint32_t serial;                          // unique per parse, identifies URL set in a client
+      char *url;
+      char *origin;
       char *scheme;
       char *host;
       char *port;
       char *path;
       char *query;
+      char storage[ESP32_HTTP_REQUEST_URL_INLINE];
       URL() 
-        :buffer(nullptr)
+        :buffer(storage)
+        ,size(sizeof(storage))
+        ,serial(0)
+        ,url(nullptr)
+        ,origin(nullptr)
         ,scheme(nullptr)
         ,host(nullptr)
         ,port(nullptr)
@@ -102,14 +187,58 @@ class esp32HTTPrequest {
         {};
       ~URL()
       {
-        delete[] buffer;
+        if(buffer != storage) delete[] buffer;
       }
     };
 
     typedef std::function<void(void*, esp32HTTPrequest*, int readyState)> readyStateChangeCB;
     typedef std::function<void(void*, esp32HTTPrequest*, size_t len)> onDataCB;
+    typedef std::function<size_t(void*, esp32HTTPrequest*, uint8_t* buf, size_t len)> bodyProviderCB;
+    typedef std::function<size_t(void*, esp32HTTPrequest*, const uint8_t* data, size_t len)> sinkCB;
+    typedef std::function<bool(void*, esp32HTTPrequest*, size_t index)> batchCB;
+    typedef std::function<void(void*, esp32HTTPrequest*, size_t sent)> batchDoneCB;
 	
   public:
+
+    // Microseconds after open() at which each phase of the request was reached, 0 if it wasn't.
+    // esp_http_client reports DNS, TCP connect and TLS handshake as one connected event.
+
+    struct  requestTimings {
+        uint32_t    start;                      // micros() when open() was called
+        uint32_t    sendStart;                  // send() started (async: worker picked up the request)
+        uint32_t    lockAcquired;               // TLSlock_S acquired, or not needed
+        uint32_t    connected;                  // connected, 0 if a kept-alive connection was reused
+        uint32_t    headersSent;                // request headers sent
+        uint32_t    firstHeader;                // first response header received (time to first byte)
+        uint32_t    firstData;                  // first response body data received
+        uint32_t    finished;                   // response complete or request failed
+    };
+    typedef std::function<void(esp32HTTPrequest*, const requestTimings&)> timingsCB;
+
+    // One request of a sendBatch(). Consecutive requests to the same origin
+    // are sent in turn on one kept-alive connection. esp_http_client can't
+    // pipeline, so each request still waits for its response: a batch saves
+    // the connect, handshake and setup per request, not the round trip.
+
+    struct  batchRequest {
+        const char* method;                     // "GET" or "POST"
+        const char* URL;
+        const char* body;                       // nullptr if none
+        size_t      len;
+        const char* contentType;                // nullptr if none
+    };
+
+    // Heap used by a request: xbuf segments and objects, header arena blocks,
+    // URL storage, pooled origin strings and the streaming transmit buffer.
+    // Memory reused across requests (arena, URL) is held but not reallocated.
+
+    struct  allocStats {
+        uint32_t    count;                      // allocations, including buffers taken from pools
+        uint32_t    bytes;                      // bytes allocated
+        uint32_t    held;                       // bytes currently held
+        uint32_t    peak;                       // most bytes held at once
+    };
+
     esp32HTTPrequest();
     ~esp32HTTPrequest();
 
@@ -118,7 +247,11 @@ class esp32HTTPrequest {
     //__________________________________________________________________________________________________________*/
     void    setDebug(bool);                                         // Turn debug message on/off
     bool    debug();                                                // is debug on or off?
-    void    async(bool set) { _async = set; }
+    void    async(bool);                                            // send() queues to worker task and returns
+                                                                    // send(const char*) and send(uint8_t*) buffers must
+                                                                    // stay valid until readyStateDone. open() waits for the
+                                                                    // worker to finish, fails while queued or in a callback.
+    void    compress(bool);                                         // gzip POST bodies (Content-Encoding: gzip)
     void    setCert(const uint8_t *pem, size_t len);                // Specify .pem file for tls
     void    useGlobalCAStore(bool);                                 // Use Global Cert pool
 
@@ -126,6 +259,9 @@ class esp32HTTPrequest {
     void    onReadyStateChange(readyStateChangeCB, void* arg = 0);  // Optional event handler for ready state change
                                                                     // or you can simply poll readyState()    
     void	  setTimeout(int);                                        // overide default timeout (seconds)
+    void    setMaxBuffer(size_t);                                   // Limit buffered response, 0 = no limit
+    bool    keepRespHeaders(std::initializer_list<const char*> names);  // Store only these response headers, {} = all
+                                                                    // names must stay valid (literals)
     void    setReqHeader(const char* name, const char* value);      // add a request header 
     void    setReqHeader(const char* name, const __FlashStringHelper* value);
     void    setReqHeader(const __FlashStringHelper *name, const char* value);
@@ -135,10 +271,17 @@ class esp32HTTPrequest {
     void    setReqHeader(const __FlashStringHelper *name, int32_t value);     
 
     bool    send();                                                 // Send the request (GET)
-    bool    send(String body);                                      // Send the request (POST)
+    bool    send(const String& body);                               // Send the request (POST), async sends a copy
+    bool    send(String&& body);                                    // Send the request (POST), async takes the body
     bool    send(const char* body);                                 // Send the request (POST)
     bool    send(const uint8_t* buffer, size_t len);                // Send the request (POST) (binary data?)
     bool    send(xbuf* body, size_t len);                            // Send the request (POST) data in an xbuf
+    bool    send(bodyProviderCB, size_t len, void* arg = 0);        // Send the request (POST) data pulled from callback
+                                                                    // len can be HTTP_REQUEST_CHUNKED
+    size_t  sendBatch(const batchRequest* requests, size_t count,   // Send requests in order (synchronous), callback after each
+                      batchCB, void* arg = 0,                       // returns false to stop. A failed request stops
+                                                                    // the batch. Returns number completed
+                      batchDoneCB done = nullptr);                  // done called once when the batch ends
     void    abort();                                                // Abort the current operation
     
     int     readyState();                                           // Return the ready state
@@ -151,20 +294,41 @@ class esp32HTTPrequest {
     bool    respHeaderExists(const char* name);                     // Does header exist by name?
     bool    respHeaderExists(const __FlashStringHelper *name);
     String  headers();                                              // Return all headers as String
+    const char* respContentType();                                  // Content-Type or nullptr
+    int32_t respContentLength();                                    // Content-Length header or -1 if none
+    const char* respETag();                                         // ETag or nullptr
+    bool    respKeepAlive();                                        // false if server sent Connection: close
 
     void    onData(onDataCB, void* arg = 0);                        // Notify when min data is available
+    void    responseSink(Print* sink);                              // Write response directly to sink, not buffered
+    void    responseSink(sinkCB, void* arg);                        // Pass response directly to callback, not buffered
     size_t  available();                                            // response available
     size_t  responseLength();                                       // indicated response length or sum of chunks to date     
+    size_t  peakBuffered();                                         // most response bytes buffered at once since open()
     int     responseHTTPcode();                                     // HTTP response code or (negative) error code
     String  responseText();                                         // response (whole* or partial* as string)
+    size_t  responseText(String&);                                  // append response to String, return length added
     size_t  responseRead(uint8_t* buffer, size_t len);              // Read response into buffer
+    size_t  responseSpans(xspan* spans, size_t count);              // Point to buffered response in place
+    size_t  responseConsume(size_t len);                            // Discard response parsed in place
     uint32_t elapsedTime();                                         // Elapsed time of in progress transaction or last completed (ms)
+    const requestTimings& timings();                                // Per-phase timing of current or last request
+    static void onTimings(timingsCB);                               // Global hook receiving timings of every completed request
+    const allocStats& allocations();                                // Heap use of this request since open() (held/peak include reused)
+    static allocStats totalAllocations();                           // Heap use of all instances since boot
+    static void closeIdle();                                        // Close pooled connections idle longer than
+                                                                    // ESP32_HTTP_REQUEST_POOL_IDLE_MS. There is no timer: call this
+                                                                    // periodically or idle connections stay open until the next request
+    static void dumpTrace(Print& out);                              // Print and clear trace (ESP32_HTTP_REQUEST_LOG 1)
     String  version();                                              // Version of esp32HTTPrequest
+    static uint32_t tlsReused();                                    // HTTPS sends on a kept-alive connection (no handshake)
+    static uint32_t tlsHandshakes();                                // HTTPS sends that needed a connect and full handshake
 
     // DO NOT USE THIS FUNCTION!!
 
     esp_http_client_handle_t client() { return _client; };
     esp_err_t _http_event_handle(esp_http_client_event_t *evt);
+    void      _asyncSend();
 
     //___________________________________________________________________________________________________________________________________
 
@@ -182,13 +346,20 @@ class esp32HTTPrequest {
     int16_t         _HTTPcode;                  // HTTP response code or (negative) exception code
     bool            _chunked;                   // Processing chunked response
     bool            _debug;                     // Debug state
-    bool            _async;                     // Perform using forked task
+    bool            _async;                     // Perform using worker task
+    bool            _holdClient;                // Keep _client between sends of sendBatch()
+    bool            _compress;                  // gzip request bodies
+    volatile bool   _asyncPending;              // Queued or running in worker task
     uint32_t        _timeout;                   // Default or user overide RxTimeout in seconds
     uint32_t        _lastActivity;              // Time of last activity 
     uint32_t        _requestStartTime;          // Time last open() issued
     uint32_t        _requestEndTime;            // Time of last disconnect
     int             _connectedPort;             // Port when connected
-    esp_http_client_handle_t _client;           // ESPAsyncTCP AsyncClient instance
+    esp_http_client_handle_t _client;           // esp_http_client instance (own or from pool)
+    char*           _clientOrigin;              // scheme://host:port of _client
+    bool            _clientConnected;           // _client has an established (TLS) session
+    bool            _clientStreamed;            // _client connection last used by open/write/read
+    uint32_t        _clientURL;                 // URL::serial of URL last set in _client, 0 unknown
     
     size_t          _contentLength;             // content-length header value or sum of chunk headers  
     size_t          _contentRead;               // number of bytes retrieved by user since last open()
@@ -196,34 +367,127 @@ class esp32HTTPrequest {
     void*           _readyStateChangeCBarg;     // associated user argument
     onDataCB        _onDataCB;                  // optional callback when data received
     void*           _onDataCBarg;               // associated user argument
+    bodyProviderCB  _bodyProviderCB;            // callback supplying POST data during send
+    void*           _bodyProviderCBarg;         // associated user argument
+    sinkCB          _sinkCB;                    // optional callback receiving response instead of _response
+    void*           _sinkCBarg;                 // associated user argument
+    Print*          _sinkPrint;                 // optional Print receiving response instead of _response
+    bool            _sinkFailed;                // sink stopped accepting data
+    size_t          _maxBuffer;                 // limit on _response->available(), 0 = none
+    size_t          _peakBuffered;              // high-water _response->available() since open()
+    bool            _rxOverflow;                // _response stayed full, rest of response discarded
+    bool            _respReceived;              // some of the response (headers or data) has arrived
     URL*            _URL;
+    requestTimings  _timings;                   // per-phase timestamps since open()
+    allocStats      _allocs;                    // heap use since open()
 
     const uint8_t*  _cert_pem;                  // -> .pem file for TLS
     size_t          _cert_len;                  // length of .pem file
     bool            _useGlobalCAStore;
 
     SemaphoreHandle_t threadLock;
+    SemaphoreHandle_t bufferLock;               // _response and its counts, taken after threadLock
 
     // request and response String buffers and header list (same queue for request and response).   
 
-    char*       _request;                       // Tx data buffer for POST
-    int         _requestLen;
+    String      _requestString;                 // Tx String body held for async send
+    xbuf*       _requestBuf;                    // Tx xbuf body, streamed by _perform()
+    bool        _requestBufOwned;               // _requestBuf is a copy to be deleted
+    const char* _requestBody;                   // Tx contiguous body (queued async or being sent)
+    int         _requestLen;                    // -1 when chunked
+    size_t      _requestSent;                   // Tx body bytes written by _streamBody()
+    xgzip*      _gzip;                          // compressing a bodyProviderCB body as it is sent
+    xbuf*       _gzipOut;                       // its output not yet sent
+    bool        _gzipDone;                      // bodyProviderCB body complete, _gzip finished
     xbuf*       _response;                      // Rx data buffer
-    header*     _headers;                       // request or (readyState > readyStateHdrsRcvd) response headers    
+    header**    _headerIndex;                   // request or (readyState > readyStateHdrsRcvd) response headers    
+    uint16_t    _headerCount;
+    uint16_t    _headerIndexSize;
+    header*     _headerHash[ESP32_HTTP_REQUEST_HEADER_BUCKETS];
+    headerBlock* _headerArena;                  // storage for headers and _headerIndex
+    const char* _respContentType;               // Well known response headers parsed on arrival
+    const char* _respETag;
+    int32_t     _respContentLength;
+    bool        _respClose;
+    const char* _keepHeaders[ESP32_HTTP_REQUEST_KEEP_HEADERS];  // names of response headers to store
+    uint32_t    _keepHashes[ESP32_HTTP_REQUEST_KEEP_HEADERS];   // and their hashes
+    uint8_t     _keepCount;                     // 0 = store all
 
     // Protected functions
 
-    header*     _addHeader(const char*, const char*);
+    header*     _addHeader(const char*, const char*, bool copyName = true, bool copyValue = true, bool repeat = false);
+    void        _addRespHeader(const char*, const char*);
+    static uint32_t _headerHashOf(const char*);
+    void*       _headerAlloc(size_t);
+    const char* _headerString(const char*);
+    void        _headerReset();
+    void        _headerClear();
+    void        _responseReset();
     header*     _getHeader(const char*);
     header*     _getHeader(int);
+    bool        _open(const char* method, const char* URL);
     bool        _buildRequest();
     bool        _parseURL(const char*);
     bool        _parseURL(String);
     void        _processChunks();
     bool        _connect();
+    bool        _checkout(const char* origin);
+    void        _checkin();
     size_t      _send(const char* body, size_t len);
+    esp_err_t   _perform();
+    esp_err_t   _streamBody(char* buf);
+    bool        _compressBody(const char* body, size_t& len);
+    int         _gzipBody(uint8_t* data, size_t demand);
+    void        _compressEnd();
+    void        _onFinish();
+    bool        _dispatch(const char* body, size_t len);
     void        _setReadyState(readyStates);
-    char*       _charstar(const __FlashStringHelper *str);
+    void        _stamp(uint32_t&);
+    void        _alloc(int32_t bytes);
+    static void _xbufAlloc(void* arg, int32_t bytes);
+    xbuf*       _newXbuf(size_t segSize, size_t maxSegSize = 0);
+    void        _deleteXbuf(xbuf*);
+
+#if ESP32_HTTP_REQUEST_LOG == 1
+
+    // Trace entries keep the format and raw arguments, formatting is deferred to dumpTrace().
+    // String arguments are copied (truncated) since they may not outlive the call.
+
+    struct traceRecord {
+        esp32HTTPrequest*   request;
+        uint32_t            time;               // ms since open()
+        const char*         format;
+        uintptr_t           arg[6];
+        uint8_t             textArg[2];         // arg index + 1 of each copied string
+        char                text[2][16];
+    };
+
+    template<typename... Args>
+    void _trace(const char* format, Args... args){
+        traceRecord record;
+        record.request = this;
+        record.time = millis() - _requestStartTime;
+        record.format = format;
+        memset(record.arg, 0, sizeof(record.arg));
+        memset(record.textArg, 0, sizeof(record.textArg));
+        int argNdx = 0;
+        int textNdx = 0;
+        int expand[] = {0, (_traceArg(record, argNdx, textNdx, args), 0)...};
+        (void) expand; (void) argNdx; (void) textNdx;
+        _traceAdd(record);
+    }
+    template<typename T>
+    static void _traceArg(traceRecord& record, int& argNdx, int& textNdx, T arg){
+        if(argNdx < 6) record.arg[argNdx++] = (uintptr_t) arg;
+    }
+    static void _traceArg(traceRecord& record, int& argNdx, int& textNdx, const char* arg);
+    static void _traceArg(traceRecord& record, int& argNdx, int& textNdx, char* arg){
+        _traceArg(record, argNdx, textNdx, (const char*) arg);
+    }
+    static void _traceAdd(const traceRecord&);
+    static traceRecord _traceRing[ESP32_HTTP_REQUEST_TRACE_DEPTH];
+#endif
     void        _onData(void *, size_t);
+    void        _toSink(const uint8_t*, size_t);
 };
 #endif 
@@ -0,0 +1,57 @@
+#pragma once
+/***********************************************************************************
+    Benchmark helpers. Each benchmark runs a body repeatedly for a fixed time
+    (shortened by a "quick" argument, as ctest runs them) and prints one line
+    of rates, allocations and peak heap for the xbuf segments or requests.
+***********************************************************************************/
+#include <Arduino.h>
+#include <chrono>
+#include <string.h>
+
+inline bool& benchQuick(){
+    static bool quick = false;
+    return quick;
+}
+
+inline void benchArgs(int argc, char** argv){
+    benchQuick() = argc > 1 && strcmp(argv[1], "quick") == 0;
+}
+
+inline double benchNow(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  Run body(iteration) until the time is up.
+
+struct benchResult {
+    double      perRun;                     // seconds per iteration
+    size_t      runs;
+};
+
+template<typename Body>
+benchResult benchRun(Body body, double seconds = 1.0){
+    if(benchQuick()) seconds /= 20;
+    size_t runs = 0;
+    double start = benchNow();
+    double elapsed;
+    do {
+        body(runs++);
+        elapsed = benchNow() - start;
+    } while(elapsed < seconds);
+    return {elapsed / runs, runs};
+}
+
+//  Segment heap taken through xbuf onAlloc.
+
+struct benchHeap {
+    uint32_t    count = 0;
+    int64_t     held = 0;
+    int64_t     peak = 0;
+
+    static void cb(void* arg, int32_t bytes){
+        benchHeap* heap = (benchHeap*) arg;
+        if(bytes > 0) heap->count++;
+        heap->held += bytes;
+        if(heap->held > heap->peak) heap->peak = heap->held;
+    }
+};
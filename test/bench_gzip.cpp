@@ -0,0 +1,67 @@
+#include <bench.h>
+#include <data.h>
+#include <fakeServer.h>
+#include <xgzip.h>
+#include <string>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+//  Compression ratio and CPU cost of xgzip (and zlib -6 for reference) on
+//  upload-like bodies. Compression pays when the CPU time is less than the
+//  transfer time it saves, which is the case for links slower than the
+//  "break-even" rate: bits saved / seconds spent compressing. Times are host
+//  CPU; scale the break-even rate down by the target's slowdown against it.
+
+static void measure(const char* name, const std::string& text, uint16_t window){
+    size_t zlen = 0;
+    size_t memory = 0;
+    benchResult result = benchRun([&](size_t){
+        xbuf out(256, 1440);
+        xgzip gzip(&out, window);
+        for(size_t pos = 0; pos < text.size(); pos += 1440){
+            gzip.write((const uint8_t*) text.data() + pos, text.size() - pos < 1440 ? text.size() - pos : 1440);
+        }
+        zlen = gzip.finish();
+        memory = gzip.memory();
+    });
+    double saved = (text.size() - zlen) * 8.0;
+    printf("%-14s xgzip %5u  ratio %.3f  %7.1f MB/s  %6zu bytes memory  break-even %8.1f Mbit/s\n",
+        name, window, zlen / (double) text.size(), text.size() / result.perRun / 1e6, memory, saved / result.perRun / 1e6);
+}
+
+#ifdef HAVE_ZLIB
+static void measureZlib(const char* name, const std::string& text){
+    uLongf zlen = 0;
+    std::string out(compressBound(text.size()), 0);
+    benchResult result = benchRun([&](size_t){
+        zlen = out.size();
+        compress2((Bytef*) &out[0], &zlen, (const Bytef*) text.data(), text.size(), 6);
+    });
+    double saved = (text.size() - zlen) * 8.0;
+    printf("%-14s zlib -6      ratio %.3f  %7.1f MB/s  %21s break-even %8.1f Mbit/s\n",
+        name, zlen / (double) text.size(), text.size() / result.perRun / 1e6, "", saved / result.perRun / 1e6);
+}
+#endif
+
+int main(int argc, char** argv){
+    benchArgs(argc, argv);
+    struct sample {
+        const char* name;
+        std::string text;
+    } samples[] = {
+        {"line protocol", lineProtocol(65536)},
+        {"csv", csvRows(65536)},
+        {"json", jsonObjects(65536)},
+        {"random text", fakeServer::pattern(65536)},
+    };
+    for(auto& sample : samples){
+        for(uint16_t window : {1024, 2048, 4096}){
+            measure(sample.name, sample.text, window);
+        }
+#ifdef HAVE_ZLIB
+        measureZlib(sample.name, sample.text);
+#endif
+    }
+    return 0;
+}
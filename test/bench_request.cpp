@@ -0,0 +1,88 @@
+#include <bench.h>
+#include <esp32HTTPrequest.h>
+#include <fakeServer.h>
+
+//  Requests per second, response bytes per second and heap per request
+//  against the fake server, for the response sizes and body types in use.
+
+static void report(const char* name, benchResult result, size_t bytes, const esp32HTTPrequest::allocStats& before){
+    esp32HTTPrequest::allocStats after = esp32HTTPrequest::totalAllocations();
+    printf("%-28s %9.0f req/s %8.1f MB/s %6.1f allocs/req %7.0f bytes/req\n", name,
+        1 / result.perRun, bytes / result.perRun / 1e6,
+        (after.count - before.count) / (double) result.runs,
+        (after.bytes - before.bytes) / (double) result.runs);
+}
+
+static void get(const char* name, const fakeResponse& response, bool text){
+    fakeServer::reset();
+    fakeServer::setDefault(response);
+    esp32HTTPrequest request;
+    esp32HTTPrequest::allocStats before = esp32HTTPrequest::totalAllocations();
+    benchResult result = benchRun([&](size_t){
+        request.open("GET", "http://bench.example.com/data");
+        request.setReqHeader("Accept", "text/plain");
+        request.setReqHeader("X-Device", "bench");
+        request.send();
+        if(text){
+            String body = request.responseText();
+        }
+        else {
+            xspan spans[8];
+            size_t count;
+            while((count = request.responseSpans(spans, 8))){
+                size_t len = 0;
+                for(size_t i=0; i<count; i++) len += spans[i].len;
+                request.responseConsume(len);
+            }
+        }
+    });
+    report(name, result, response.body.size(), before);
+}
+
+static void post(const char* name, size_t len){
+    fakeServer::reset();
+    std::string text = fakeServer::pattern(len, 5);
+    esp32HTTPrequest request;
+    esp32HTTPrequest::allocStats before = esp32HTTPrequest::totalAllocations();
+    benchResult result = benchRun([&](size_t){
+        xbuf body(256, 1440);
+        body.write((const uint8_t*) text.data(), text.size());
+        request.open("POST", "http://bench.example.com/post");
+        request.setReqHeader("Content-Type", "text/plain");
+        request.send(&body, body.available());
+    });
+    report(name, result, len, before);
+}
+
+//  Cost of open() alone, reusing the URL already parsed and set in the
+//  client, or switching between two URLs on the same connection.
+
+static void open(const char* name, bool change){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    const char* urls[2] = {"http://bench.example.com/telemetry?device=1",
+                           "http://bench.example.com/telemetry?device=2"};
+    request.open("POST", urls[0]);
+    int setURLs = fakeServer::setURLs();
+    esp32HTTPrequest::allocStats before = esp32HTTPrequest::totalAllocations();
+    benchResult result = benchRun([&](size_t run){
+        request.open("POST", urls[change ? run & 1 : 0]);
+    });
+    esp32HTTPrequest::allocStats after = esp32HTTPrequest::totalAllocations();
+    printf("%-28s %9.0f ns/open %6.1f allocs/open %6.2f set_url/open\n", name,
+        result.perRun * 1e9, (after.count - before.count) / (double) result.runs,
+        (fakeServer::setURLs() - setURLs) / (double) result.runs);
+}
+
+int main(int argc, char** argv){
+    benchArgs(argc, argv);
+    get("GET 100 text", fakeResponse::fixed(fakeServer::pattern(100)), true);
+    get("GET 4K text", fakeResponse::fixed(fakeServer::pattern(4096)), true);
+    get("GET 64K spans", fakeResponse::fixed(fakeServer::pattern(65536)), false);
+    get("GET 64K chunked spans", fakeResponse::chunkedBody(fakeServer::pattern(65536), 1024), false);
+    get("GET 64K random pieces", fakeResponse::huge(65536), false);
+    post("POST xbuf 4K", 4096);
+    open("open same URL", false);
+    open("open changing URL", true);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <bench.h>
+#include <data.h>
+#include <xbuf.h>
+#include <algorithm>
+#include <vector>
+
+//  xbuf write/read throughput and segment allocations for typical piece sizes.
+
+static void writeRead(size_t segSize, size_t piece){
+    const size_t total = 1 << 20;
+    std::vector<uint8_t> data(piece, 'x');
+    benchHeap heap;
+    benchResult result = benchRun([&](size_t){
+        xbuf buf(segSize);
+        buf.onAlloc(benchHeap::cb, &heap);
+        uint8_t out[1440];
+        for(size_t done = 0; done < total; done += piece){
+            buf.write(data.data(), piece);
+            if(buf.available() >= 4096){
+                while(buf.available()) buf.read(out, sizeof(out));
+            }
+        }
+    });
+    printf("xbuf seg %5zu piece %5zu: %8.1f MB/s  %8.1f allocs/MB  peak %lld bytes\n",
+        segSize, piece, total / result.perRun / 1e6, heap.count / (double) result.runs, (long long) heap.peak);
+}
+
+//  Response-like traffic: each run fills an xbuf and frees it, as a request
+//  does with its response, with and without the segment pool.
+
+static void pooled(bool pool, size_t segSize, size_t piece){
+    const size_t total = 1 << 20;
+    const size_t response = 16384;
+    std::vector<uint8_t> data(piece, 'x');
+    xbuf::segPool(pool ? segSize : 0, pool ? (response + segSize - 1) / segSize : 0);
+    size_t before = hostMallocCount;
+    benchResult result = benchRun([&](size_t){
+        uint8_t out[1440];
+        for(size_t done = 0; done < total; done += response){
+            xbuf buf(segSize);
+            for(size_t filled = 0; filled < response; filled += piece){
+                buf.write(data.data(), piece);
+            }
+            while(buf.available()) buf.read(out, sizeof(out));
+        }
+    });
+    printf("xbuf %-6s seg %5zu piece %5zu: %8.1f MB/s  %8.1f mallocs/MB\n",
+        pool ? "pool" : "malloc", segSize, piece, total / result.perRun / 1e6,
+        (hostMallocCount - before) / (double) result.runs);
+    xbuf::segPool(0, 0);
+}
+
+//  The indexOf() that xbuf used to have: a byte by byte comparison of the
+//  target at every position, walking the segments from the start each call.
+
+static int naiveIndexOf(xbuf& buf, const char* target){
+    std::vector<xspan> spans(buf.available() / 16 + 1);
+    size_t count = buf.spans(spans.data(), spans.size());
+    size_t len = strlen(target);
+    size_t avail = buf.available();
+    size_t span = 0;
+    size_t at = 0;
+    for(size_t pos = 0; pos + len <= avail; pos++){
+        size_t i = 0;
+        size_t cmpSpan = span;
+        size_t cmpAt = at;
+        while(i < len && spans[cmpSpan].data[cmpAt] == (uint8_t) target[i]){
+            i++;
+            if(++cmpAt == spans[cmpSpan].len && cmpSpan + 1 < count){
+                cmpSpan++;
+                cmpAt = 0;
+            }
+        }
+        if(i == len) return pos;
+        if(++at == spans[span].len && span + 1 < count){
+            span++;
+            at = 0;
+        }
+    }
+    return -1;
+}
+
+//  Search line protocol for a target that isn't there, built like a line
+//  so that the first character and short prefixes match often.
+
+static void indexOf(size_t haystack, size_t needle){
+    xbuf buf(1440);
+    std::string text = lineProtocol(haystack, 1);
+    buf.write((const uint8_t*) text.data(), text.size());
+    std::string target = lineProtocol(needle + 200, 9).substr(0, needle);
+    target.back() = '#';
+    int found = -1;
+    benchResult fast = benchRun([&](size_t){found = std::max(found, buf.indexOf(target.c_str()));}, 0.5);
+    benchResult naive = benchRun([&](size_t){found = std::max(found, naiveIndexOf(buf, target.c_str()));}, 0.5);
+    printf("indexOf haystack %7zu needle %3zu: %8.1f MB/s  naive %8.1f MB/s  %5.1fx%s\n",
+        haystack, needle, haystack / fast.perRun / 1e6, haystack / naive.perRun / 1e6,
+        naive.perRun / fast.perRun, found == -1 ? "" : "  (found?)");
+}
+
+int main(int argc, char** argv){
+    benchArgs(argc, argv);
+    for(size_t segSize : {64, 256, 1440}){
+        for(size_t piece : {16, 256, 1440}){
+            writeRead(segSize, piece);
+        }
+    }
+    for(size_t segSize : {64, 1440}){
+        for(bool pool : {false, true}){
+            pooled(pool, segSize, 256);
+        }
+    }
+    for(size_t haystack : {1024, 16384, 262144, 1048576}){
+        for(size_t needle : {2, 8, 32, 128}){
+            indexOf(haystack, needle);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+/***********************************************************************************
+    Deterministic sample bodies resembling what devices upload: InfluxDB line
+    protocol and CSV rows with slowly varying readings, and JSON objects.
+***********************************************************************************/
+#include <stdio.h>
+#include <string>
+
+inline std::string lineProtocol(size_t len, uint32_t seed = 1){
+    std::string text;
+    uint32_t state = seed;
+    uint32_t time = 1700000000;
+    double watts = 1234.5;
+    while(text.size() < len){
+        state = state * 1103515245u + 12345u;
+        watts += ((int)((state >> 16) % 200) - 100) / 10.0;
+        char line[160];
+        snprintf(line, sizeof(line), "power,device=iotawatt,channel=ch%u,unit=Watts value=%.1f %u000000000\n",
+            (state >> 8) % 14 + 1, watts, time);
+        text += line;
+        time += 5;
+    }
+    text.resize(len);
+    return text;
+}
+
+inline std::string csvRows(size_t len, uint32_t seed = 1){
+    std::string text = "time,voltage,mains,solar,heatpump\n";
+    uint32_t state = seed;
+    uint32_t time = 1700000000;
+    while(text.size() < len){
+        state = state * 1103515245u + 12345u;
+        char line[120];
+        snprintf(line, sizeof(line), "%u,%.2f,%.1f,%.1f,%.1f\n", time, 120 + (state >> 16) % 300 / 100.0,
+            800 + (state >> 8) % 900 / 10.0, (state >> 4) % 3000 / 10.0, (state >> 12) % 1500 / 10.0);
+        text += line;
+        time += 10;
+    }
+    text.resize(len);
+    return text;
+}
+
+inline std::string jsonObjects(size_t len, uint32_t seed = 1){
+    std::string text;
+    uint32_t state = seed;
+    while(text.size() < len){
+        state = state * 1103515245u + 12345u;
+        char line[160];
+        snprintf(line, sizeof(line), "{\"device\":\"iotawatt-%u\",\"channel\":%u,\"watts\":%.1f,\"pf\":%.2f}\n",
+            (state >> 20) % 4, (state >> 8) % 14, (state >> 4) % 50000 / 10.0, (state >> 12) % 100 / 100.0);
+        text += line;
+    }
+    text.resize(len);
+    return text;
+}
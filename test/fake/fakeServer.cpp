@@ -0,0 +1,534 @@
+#include "fakeServer.h"
+#include <Arduino.h>
+#include <deque>
+#include <mutex>
+
+struct esp_http_client {
+    http_event_handle_cb    handler;
+    void*           userData;
+    std::string     url;
+    esp_http_client_method_t method;
+    const char*     postData;                   // not copied, read at send time like esp_http_client
+    int             postLen;
+    std::vector<std::pair<std::string, std::string>> headers;
+    int             connection;                 // 0 = not connected
+    bool            dead;                       // connection closed by server, not yet by client
+    enum {IDLE, REQUEST, RESPONSE} state;       // RESPONSE = open/write/read response not reset by open()
+    std::string     written;                    // body written with esp_http_client_write
+    int             writeLen;
+    fakeResponse    response;
+    size_t          delivered;
+    uint32_t        random;
+};
+
+static std::mutex                   serverMux;
+static std::deque<fakeResponse>     script;
+static fakeResponse                 defaultResponse = fakeResponse::fixed("OK");
+static std::vector<fakeRequest>     requestLog;
+static int      connectCount = 0;
+static int      initCount = 0;
+static int      liveCount = 0;
+static int      setURLCount = 0;
+static int      misuseCount = 0;
+static int      nextConnection = 1;
+static int      staleBelow = 0;                 // idle connections below this id were closed by server
+
+static void dispatch(esp_http_client* client, esp_http_client_event_id_t id, void* data = nullptr, int len = 0,
+                     const char* key = nullptr, const char* value = nullptr){
+    if( ! client->handler) return;
+    esp_http_client_event_t evt;
+    memset(&evt, 0, sizeof(evt));
+    evt.event_id = id;
+    evt.client = client;
+    evt.data = data;
+    evt.data_len = len;
+    evt.user_data = client->userData;
+    std::string k = key ? key : "";
+    std::string v = value ? value : "";
+    evt.header_key = key ? &k[0] : nullptr;
+    evt.header_value = value ? &v[0] : nullptr;
+    client->handler(&evt);
+}
+
+static void setHeader(esp_http_client* client, const char* key, const char* value){
+    for(auto& header : client->headers){
+        if(strcasecmp(header.first.c_str(), key) == 0){
+            header.second = value;
+            return;
+        }
+    }
+    client->headers.push_back({key, value});
+}
+
+static std::string hostOf(const std::string& url){
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    size_t end = url.find_first_of(":/?", start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+static void connect(esp_http_client* client){
+    if(client->connection) return;
+    {
+        std::lock_guard<std::mutex> lock(serverMux);
+        client->connection = nextConnection++;
+        connectCount++;
+    }
+    client->dead = false;
+    dispatch(client, HTTP_EVENT_ON_CONNECTED);
+}
+
+static bool stale(esp_http_client* client){
+    std::lock_guard<std::mutex> lock(serverMux);
+    if(client->connection && client->connection < staleBelow){
+        client->dead = true;
+    }
+    return client->dead;
+}
+
+static void prepareHeaders(esp_http_client* client, int writeLen){
+    char len[16];
+    snprintf(len, sizeof(len), "%d", writeLen);
+    if(writeLen >= 0){
+        setHeader(client, "Content-Length", len);
+    }
+    else {
+        setHeader(client, "Transfer-Encoding", "chunked");
+        client->method = HTTP_METHOD_POST;
+    }
+}
+
+static bool dechunk(const std::string& wire, std::string& body){
+    size_t pos = 0;
+    while(true){
+        size_t eol = wire.find("\r\n", pos);
+        if(eol == std::string::npos) return false;
+        size_t len = strtoul(wire.substr(pos, eol - pos).c_str(), nullptr, 16);
+        pos = eol + 2;
+        if(wire.size() < pos + len + 2 || wire.compare(pos + len, 2, "\r\n") != 0) return false;
+        body.append(wire, pos, len);
+        pos += len + 2;
+        if( ! len) return pos == wire.size();
+    }
+}
+
+//  Log the request as the server received it and pick its response.
+
+static void receive(esp_http_client* client, const std::string& body, bool streamed){
+    fakeRequest request;
+    request.method = client->method == HTTP_METHOD_POST ? "POST" : "GET";
+    request.url = client->url;
+    request.headers = client->headers;
+    request.body = body;
+    request.connection = client->connection;
+    request.streamed = streamed;
+    std::lock_guard<std::mutex> lock(serverMux);
+    request.newConnection = true;
+    for(auto& previous : requestLog){
+        if(previous.connection == client->connection) request.newConnection = false;
+    }
+    requestLog.push_back(request);
+    if(script.empty()){
+        client->response = defaultResponse;
+    }
+    else {
+        client->response = script.front();
+        script.pop_front();
+    }
+    client->delivered = 0;
+    client->random = 2463534242u + client->connection;
+}
+
+static void sendHeaders(esp_http_client* client){
+    fakeResponse& response = client->response;
+    if(response.chunked){
+        dispatch(client, HTTP_EVENT_ON_HEADER, nullptr, 0, "Transfer-Encoding", "chunked");
+    }
+    else {
+        dispatch(client, HTTP_EVENT_ON_HEADER, nullptr, 0, "Content-Length", std::to_string(response.body.size()).c_str());
+    }
+    for(auto& header : response.headers){
+        dispatch(client, HTTP_EVENT_ON_HEADER, nullptr, 0, header.first.c_str(), header.second.c_str());
+    }
+    if(response.close){
+        dispatch(client, HTTP_EVENT_ON_HEADER, nullptr, 0, "Connection", "close");
+    }
+}
+
+//  Size of the next piece of body, 0 when complete, -1 if the connection drops.
+
+static int nextPiece(esp_http_client* client, size_t room){
+    fakeResponse& response = client->response;
+    size_t left = response.body.size() - client->delivered;
+    if( ! left) return 0;
+    if(response.dropAfter && client->delivered >= response.dropAfter){
+        client->dead = true;
+        return -1;
+    }
+    size_t piece = response.piece;
+    if( ! piece){
+        client->random ^= client->random << 13;
+        client->random ^= client->random >> 17;
+        client->random ^= client->random << 5;
+        piece = 1 + client->random % 1440;
+    }
+    if(piece > left) piece = left;
+    if(piece > room) piece = room;
+    if(response.dropAfter && client->delivered + piece > response.dropAfter){
+        piece = response.dropAfter - client->delivered;
+    }
+    if(response.dripMs){
+        delay(response.dripMs);
+    }
+    return piece;
+}
+
+//**************************************************************************************************************
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config){
+    esp_http_client* client = new esp_http_client;
+    client->handler = config->event_handler;
+    client->userData = config->user_data;
+    client->url = config->url ? config->url : "";
+    client->method = config->method;
+    client->postData = nullptr;
+    client->postLen = 0;
+    client->connection = 0;
+    client->dead = false;
+    client->state = esp_http_client::IDLE;
+    client->writeLen = 0;
+    client->delivered = 0;
+    client->random = 1;
+    setHeader(client, "User-Agent", "ESP32 HTTP Client/1.0");
+    setHeader(client, "Host", hostOf(client->url).c_str());
+    std::lock_guard<std::mutex> lock(serverMux);
+    initCount++;
+    liveCount++;
+    return client;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client){
+    if(client->state != esp_http_client::IDLE){
+        std::lock_guard<std::mutex> lock(serverMux);
+        misuseCount++;
+        return ESP_FAIL;
+    }
+    connect(client);
+    prepareHeaders(client, client->postLen);
+    dispatch(client, HTTP_EVENT_HEADERS_SENT);
+    if(stale(client)){
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    receive(client, std::string(client->postData ? client->postData : "", client->postLen), false);
+    if(client->response.drop){
+        client->dead = true;
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    sendHeaders(client);
+    int piece;
+    while((piece = nextPiece(client, 1440)) > 0){
+        std::string data = client->response.body.substr(client->delivered, piece);
+        client->delivered += piece;
+        dispatch(client, HTTP_EVENT_ON_DATA, &data[0], piece);
+    }
+    if(piece < 0){
+        return ESP_FAIL;
+    }
+    dispatch(client, HTTP_EVENT_ON_FINISH);
+    if(client->response.close){
+        esp_http_client_close(client);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len){
+    if(client->state == esp_http_client::REQUEST ||
+      (client->state == esp_http_client::RESPONSE && ! esp_http_client_is_complete_data_received(client))){
+        std::lock_guard<std::mutex> lock(serverMux);
+        misuseCount++;
+        return ESP_FAIL;
+    }
+    connect(client);
+    prepareHeaders(client, write_len);
+    dispatch(client, HTTP_EVENT_HEADERS_SENT);
+    client->state = esp_http_client::REQUEST;
+    client->written.clear();
+    client->writeLen = write_len;
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len){
+    if(client->state != esp_http_client::REQUEST) return -1;
+    client->written.append(buffer, len);
+    return len;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client){
+    if(client->state != esp_http_client::REQUEST) return ESP_FAIL;
+    client->state = esp_http_client::RESPONSE;
+    client->response = fakeResponse();
+    client->delivered = 0;
+    if(stale(client)){
+        return ESP_FAIL;
+    }
+    std::string body = client->written;
+    if(client->writeLen < 0){
+        body.clear();
+        if( ! dechunk(client->written, body)){
+            body = "<bad chunked encoding>";
+        }
+    }
+    receive(client, body, true);
+    if(client->response.drop){
+        client->dead = true;
+        return ESP_FAIL;
+    }
+    sendHeaders(client);
+    return client->response.chunked ? 0 : client->response.body.size();
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len){
+    if(client->state != esp_http_client::RESPONSE || client->dead) return -1;
+    int piece = nextPiece(client, len);
+    if(piece > 0){
+        memcpy(buffer, client->response.body.data() + client->delivered, piece);
+        client->delivered += piece;
+        dispatch(client, HTTP_EVENT_ON_DATA, buffer, piece);
+    }
+    if(esp_http_client_is_complete_data_received(client) && client->response.close){
+        client->dead = true;
+    }
+    return piece;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client){
+    return client->response.chunked;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client){
+    return client->delivered == client->response.body.size();
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client){
+    return client->response.status;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client){
+    return client->response.chunked ? -1 : (int) client->response.body.size();
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url){
+    client->url = url;
+    setHeader(client, "Host", hostOf(client->url).c_str());
+    std::lock_guard<std::mutex> lock(serverMux);
+    setURLCount++;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len){
+    client->postData = data;
+    client->postLen = data ? len : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value){
+    setHeader(client, key, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char* key){
+    for(auto it = client->headers.begin(); it != client->headers.end(); ){
+        it = strcasecmp(it->first.c_str(), key) == 0 ? client->headers.erase(it) : it + 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method){
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms){
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void* data){
+    client->userData = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client){
+    client->state = esp_http_client::IDLE;
+    if(client->connection){
+        client->connection = 0;
+        client->dead = false;
+        dispatch(client, HTTP_EVENT_DISCONNECTED);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client){
+    if( ! client) return ESP_FAIL;
+    esp_http_client_close(client);
+    delete client;
+    std::lock_guard<std::mutex> lock(serverMux);
+    liveCount--;
+    return ESP_OK;
+}
+
+const char* esp_err_to_name(esp_err_t code){
+    switch(code){
+        case ESP_OK: return "ESP_OK";
+        case ESP_ERR_HTTP_FETCH_HEADER: return "ESP_ERR_HTTP_FETCH_HEADER";
+        default: return "ESP_FAIL";
+    }
+}
+
+//**************************************************************************************************************
+fakeResponse fakeResponse::fixed(const std::string& body, int status){
+    fakeResponse response;
+    response.body = body;
+    response.status = status;
+    return response;
+}
+
+fakeResponse fakeResponse::chunkedBody(const std::string& body, size_t piece){
+    fakeResponse response;
+    response.body = body;
+    response.chunked = true;
+    response.piece = piece;
+    return response;
+}
+
+fakeResponse fakeResponse::drip(const std::string& body, size_t piece, uint32_t ms){
+    fakeResponse response;
+    response.body = body;
+    response.piece = piece;
+    response.dripMs = ms;
+    return response;
+}
+
+fakeResponse fakeResponse::huge(size_t len, uint32_t seed){
+    fakeResponse response;
+    response.body = fakeServer::pattern(len, seed);
+    response.piece = 0;
+    return response;
+}
+
+fakeResponse fakeResponse::fromRaw(const std::string& raw){
+    fakeResponse response;
+    size_t end = raw.find("\r\n\r\n");
+    size_t pos = raw.find(' ');
+    response.status = pos < end ? atoi(raw.c_str() + pos + 1) : 200;
+    pos = raw.find("\r\n");
+    bool chunked = false;
+    while(pos < end){
+        size_t eol = raw.find("\r\n", pos + 2);
+        std::string line = raw.substr(pos + 2, eol - pos - 2);
+        size_t colon = line.find(':');
+        std::string name = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        if(strcasecmp(name.c_str(), "transfer-encoding") == 0){
+            chunked = strcasecmp(value.c_str(), "chunked") == 0;
+        }
+        else if(strcasecmp(name.c_str(), "connection") == 0 && strcasecmp(value.c_str(), "close") == 0){
+            response.close = true;
+        }
+        else if(strcasecmp(name.c_str(), "content-length") != 0){
+            response.headers.push_back({name, value});
+        }
+        pos = eol;
+    }
+    std::string body = end == std::string::npos ? "" : raw.substr(end + 4);
+    response.chunked = chunked;
+    if( ! chunked || ! dechunk(body, response.body)){
+        response.body = body;
+    }
+    return response;
+}
+
+//**************************************************************************************************************
+const char* fakeRequest::header(const char* name) const {
+    for(auto& h : headers){
+        if(strcasecmp(h.first.c_str(), name) == 0) return h.second.c_str();
+    }
+    return nullptr;
+}
+
+//**************************************************************************************************************
+void fakeServer::reset(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    script.clear();
+    requestLog.clear();
+    defaultResponse = fakeResponse::fixed("OK");
+    connectCount = 0;
+    setURLCount = 0;
+    misuseCount = 0;
+    initCount = 0;
+}
+
+void fakeServer::respond(const fakeResponse& response){
+    std::lock_guard<std::mutex> lock(serverMux);
+    script.push_back(response);
+}
+
+void fakeServer::setDefault(const fakeResponse& response){
+    std::lock_guard<std::mutex> lock(serverMux);
+    defaultResponse = response;
+}
+
+void fakeServer::dropIdle(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    staleBelow = nextConnection;
+}
+
+std::vector<fakeRequest> fakeServer::requests(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return requestLog;
+}
+
+fakeRequest fakeServer::lastRequest(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return requestLog.empty() ? fakeRequest() : requestLog.back();
+}
+
+size_t fakeServer::requestCount(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return requestLog.size();
+}
+
+int fakeServer::connects(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return connectCount;
+}
+
+int fakeServer::inits(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return initCount;
+}
+
+int fakeServer::liveHandles(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return liveCount;
+}
+
+int fakeServer::setURLs(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return setURLCount;
+}
+
+int fakeServer::misuse(){
+    std::lock_guard<std::mutex> lock(serverMux);
+    return misuseCount;
+}
+
+std::string fakeServer::pattern(size_t len, uint32_t seed){
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz,=\n ";
+    std::string text(len, ' ');
+    uint32_t state = seed * 2654435761u + 1;
+    for(size_t i=0; i<len; i++){
+        state = state * 1103515245u + 12345u;
+        text[i] = digits[(state >> 16) % (sizeof(digits) - 1)];
+    }
+    return text;
+}
@@ -0,0 +1,71 @@
+#pragma once
+/***********************************************************************************
+    fakeServer implements esp_http_client on the host and plays the server side.
+
+    Responses are scripted: each request takes the next queued fakeResponse,
+    or the default response when the queue is empty. A response can be fixed
+    length or chunked, delivered in fixed or random size pieces, dripped
+    with a delay before each piece, and can close or drop the connection.
+    fromRaw() replays a canned HTTP response as it would appear on the wire.
+
+    The client side follows esp_http_client: a handle keeps its connection
+    after a complete response unless the server closes it, headers set on a
+    handle persist until deleted, the post field is a pointer read at send
+    time, and events go to the handle's user_data through its event handler.
+    Using esp_http_client_perform() on a handle left mid-response by the
+    open/write/read API is counted as misuse, as it hangs or fails on target.
+
+    Each request is logged with its headers, body and the connection it went
+    out on, so tests can check what actually reached the server.
+***********************************************************************************/
+#include <esp_HTTP_client.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct fakeResponse {
+    int         status = 200;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    bool        chunked = false;            // length not sent, client sees chunked response
+    size_t      piece = 1440;               // body bytes per ON_DATA event, 0 = random 1..1440
+    uint32_t    dripMs = 0;                 // delay before each piece
+    bool        close = false;              // Connection: close, server closes after response
+    bool        drop = false;               // connection drops after request, no response
+    size_t      dropAfter = 0;              // connection drops after this much body, 0 = never
+
+    static fakeResponse fixed(const std::string& body, int status = 200);
+    static fakeResponse chunkedBody(const std::string& body, size_t piece = 256);
+    static fakeResponse drip(const std::string& body, size_t piece, uint32_t ms);
+    static fakeResponse huge(size_t len, uint32_t seed = 1);
+    static fakeResponse fromRaw(const std::string& raw);
+};
+
+struct fakeRequest {
+    std::string method;
+    std::string url;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    int         connection;                 // id of connection the request went out on
+    bool        newConnection;              // connection was opened for this request
+    bool        streamed;                   // sent with open/write rather than perform
+
+    const char* header(const char* name) const;     // nullptr if not sent
+};
+
+class fakeServer {
+    public:
+        static void         reset();                        // clear script, log and counters
+        static void         respond(const fakeResponse&);   // queue response to next request
+        static void         setDefault(const fakeResponse&);// response when queue is empty
+        static void         dropIdle();                     // server closes all idle connections
+        static std::vector<fakeRequest> requests();
+        static fakeRequest  lastRequest();
+        static size_t       requestCount();
+        static int          connects();                     // connections opened
+        static int          inits();                        // handles created
+        static int          liveHandles();                  // handles not cleaned up
+        static int          setURLs();                      // esp_http_client_set_url calls
+        static int          misuse();                       // perform on a handle mid-response
+        static std::string  pattern(size_t len, uint32_t seed = 1); // deterministic huge body
+};
@@ -0,0 +1,39 @@
+#pragma once
+//  Inflate a gzip stream with zlib to check what was sent, "" without zlib.
+#include <string>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+inline bool haveZlib(){
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline std::string gunzip(const std::string& zipped, bool* complete = nullptr){
+    std::string text;
+    bool end = false;
+#ifdef HAVE_ZLIB
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit2(&stream, 16 + 15);
+    stream.next_in = (Bytef*) zipped.data();
+    stream.avail_in = zipped.size();
+    char buf[4096];
+    int result;
+    do {
+        stream.next_out = (Bytef*) buf;
+        stream.avail_out = sizeof(buf);
+        result = inflate(&stream, Z_NO_FLUSH);
+        text.append(buf, sizeof(buf) - stream.avail_out);
+    } while(result == Z_OK);
+    end = result == Z_STREAM_END && stream.avail_in == 0;
+    inflateEnd(&stream);
+#endif
+    if(complete) *complete = end;
+    return text;
+}
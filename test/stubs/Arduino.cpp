@@ -0,0 +1,226 @@
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+HardwareSerial Serial;
+int hostMallocFail = 0;
+size_t hostMallocCount = 0;
+size_t String::copies = 0;
+std::atomic<int> hostTasksCreated{0};
+
+//  Semaphores: a count with an owner and depth for recursive mutexes.
+
+struct hostSemaphore {
+    std::mutex              mux;
+    std::condition_variable cv;
+    UBaseType_t             count;
+    UBaseType_t             max;
+    std::thread::id         owner;
+    int                     depth;
+};
+
+struct hostQueue {
+    std::mutex              mux;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t             length;
+    UBaseType_t             itemSize;
+};
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+//  Wait on cv until ready() or the ticks (ms) pass, portMAX_DELAY waits forever.
+
+template<typename Ready>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Ready ready){
+    if(ticks == portMAX_DELAY){
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+//**************************************************************************************************************
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial){
+    hostSemaphore* sem = new hostSemaphore;
+    sem->count = initial;
+    sem->max = max;
+    sem->depth = 0;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(){
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(){
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks){
+    std::unique_lock<std::mutex> lock(sem->mux);
+    if( ! waitFor(sem->cv, lock, ticks, [sem]{return sem->count > 0;})){
+        return pdFALSE;
+    }
+    sem->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem){
+    std::unique_lock<std::mutex> lock(sem->mux);
+    if(sem->count >= sem->max){
+        return pdFALSE;
+    }
+    sem->count++;
+    sem->cv.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks){
+    std::unique_lock<std::mutex> lock(sem->mux);
+    if(sem->depth && sem->owner == std::this_thread::get_id()){
+        sem->depth++;
+        return pdTRUE;
+    }
+    if( ! waitFor(sem->cv, lock, ticks, [sem]{return sem->count > 0;})){
+        return pdFALSE;
+    }
+    sem->count--;
+    sem->owner = std::this_thread::get_id();
+    sem->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem){
+    std::unique_lock<std::mutex> lock(sem->mux);
+    if( ! sem->depth || sem->owner != std::this_thread::get_id()){
+        return pdFALSE;
+    }
+    if(--sem->depth == 0){
+        sem->owner = std::thread::id();
+        sem->count++;
+        sem->cv.notify_one();
+    }
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem){
+    delete sem;
+}
+
+//**************************************************************************************************************
+//  Creating a queue takes a moment, so tasks racing to create one overlap.
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    hostQueue* queue = new hostQueue;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks){
+    std::unique_lock<std::mutex> lock(queue->mux);
+    if( ! waitFor(queue->cv, lock, ticks, [queue]{return queue->items.size() < queue->length;})){
+        return pdFALSE;
+    }
+    const uint8_t* bytes = (const uint8_t*) item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks){
+    std::unique_lock<std::mutex> lock(queue->mux);
+    if( ! waitFor(queue->cv, lock, ticks, [queue]{return ! queue->items.empty();})){
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+//  Tasks run detached. The library's tasks never return.
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t* handle){
+    hostTasksCreated++;
+    std::thread(task, arg).detach();
+    if(handle){
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks){
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks ? ticks : 0));
+    std::this_thread::yield();
+}
+
+//**************************************************************************************************************
+void* hostMalloc(size_t size){
+    if(hostMallocFail > 0){
+        hostMallocFail--;
+        return nullptr;
+    }
+    hostMallocCount++;
+    return malloc(size);
+}
+
+//**************************************************************************************************************
+unsigned long millis(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(uint32_t ms){
+    vTaskDelay(ms);
+}
+
+void yield(){
+    std::this_thread::yield();
+}
+
+//**************************************************************************************************************
+size_t Print::write(const uint8_t* buffer, size_t size){
+    size_t written = 0;
+    while(written < size && write(buffer[written])){
+        written++;
+    }
+    return written;
+}
+
+size_t Print::vprintf(const char* format, va_list args){
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+    if(len <= 0){
+        return 0;
+    }
+    std::vector<char> text(len + 1);
+    vsnprintf(text.data(), text.size(), format, args);
+    return write((const uint8_t*) text.data(), len);
+}
+
+size_t Print::printf(const char* format, ...){
+    va_list args;
+    va_start(args, format);
+    size_t len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
+
+size_t Print::printf_P(const char* format, ...){
+    va_list args;
+    va_start(args, format);
+    size_t len = vprintf(format, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,146 @@
+#pragma once
+/***********************************************************************************
+    Host stand-ins for the parts of Arduino-ESP32 and FreeRTOS that the library
+    uses, so it can be built and exercised on Linux (see test/CMakeLists.txt).
+
+    FreeRTOS semaphores, queues and tasks are mapped to std::thread primitives,
+    one tick is one millisecond. portMUX critical sections are recursive
+    mutexes. ESP32 is deliberately not defined, so xbuf uses its own host locking.
+***********************************************************************************/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <strings.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <pgmspace.h>
+
+//  FreeRTOS
+
+typedef struct hostSemaphore* SemaphoreHandle_t;
+typedef struct hostQueue* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define portMAX_DELAY           0xffffffffUL
+#define portTICK_PERIOD_MS      1
+#define pdMS_TO_TICKS(ms)       (ms)
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+BaseType_t  xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t  xSemaphoreGive(SemaphoreHandle_t);
+BaseType_t  xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t);
+BaseType_t  xSemaphoreGiveRecursive(SemaphoreHandle_t);
+void        vSemaphoreDelete(SemaphoreHandle_t);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t  xQueueSend(QueueHandle_t, const void* item, TickType_t);
+BaseType_t  xQueueReceive(QueueHandle_t, void* item, TickType_t);
+
+BaseType_t  xTaskCreate(TaskFunction_t, const char* name, uint32_t stack, void* arg, UBaseType_t priority, TaskHandle_t*);
+extern std::atomic<int> hostTasksCreated;       // xTaskCreate calls
+void        vTaskDelay(TickType_t);
+
+struct portMUX_TYPE {
+    std::recursive_mutex mux;
+};
+#define portMUX_INITIALIZER_UNLOCKED    {}
+#define portENTER_CRITICAL(m)           (m)->mux.lock()
+#define portEXIT_CRITICAL(m)            (m)->mux.unlock()
+
+//  Segment allocation for xbuf. hostMallocFail makes that many of the
+//  following allocations fail, so tests can run out of memory on demand.
+//  hostMallocCount counts the segments actually taken from the heap.
+
+extern int  hostMallocFail;
+extern size_t hostMallocCount;
+void*       hostMalloc(size_t size);
+#define XBUF_MALLOC(size)   hostMalloc(size)
+
+//  Arduino core
+
+unsigned long millis();
+unsigned long micros();
+void        delay(uint32_t ms);
+void        yield();
+
+#define DEC 10
+#define HEX 16
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+class String {
+    public:
+        String() {}
+        String(const char* str) : _str(str ? str : "") {}
+        String(const char* str, size_t len) : _str(str, len) {}
+        String(int value) : _str(std::to_string(value)) {}
+        String(unsigned value) : _str(std::to_string(value)) {}
+        String(long value) : _str(std::to_string(value)) {}
+        String(unsigned long value) : _str(std::to_string(value)) {}
+        String(const String& str) : _str(str._str) {copies++;}
+        String(String&& str) = default;
+        String&     operator=(const String& str) {_str = str._str; copies++; return *this;}
+        String&     operator=(String&& str) = default;
+
+        static size_t copies;       // Strings copied, for tests that check a body isn't duplicated
+
+        bool        reserve(unsigned size) {_str.reserve(size); return true;}
+        unsigned    length() const {return _str.size();}
+        const char* c_str() const {return _str.c_str();}
+        bool        concat(const char* str, unsigned len) {_str.append(str, len); return true;}
+        bool        concat(const char* str) {_str += str; return true;}
+        String&     operator+=(const char* str) {_str += str; return *this;}
+        String&     operator+=(const String& str) {_str += str._str; return *this;}
+        String&     operator+=(char c) {_str += c; return *this;}
+        bool        operator==(const char* str) const {return _str == str;}
+        bool        operator==(const String& str) const {return _str == str._str;}
+        char        operator[](unsigned index) const {return _str[index];}
+        String      substring(unsigned from, unsigned to) const {return String(_str.substr(from, to - from).c_str());}
+        bool        equalsIgnoreCase(const String& str) const {return strcasecmp(_str.c_str(), str.c_str()) == 0;}
+
+    private:
+        std::string _str;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t      write(const char* str) {return str ? write((const uint8_t*) str, strlen(str)) : 0;}
+        size_t      write(const char* buffer, size_t size) {return write((const uint8_t*) buffer, size);}
+        size_t      printf(const char* format, ...) __attribute__ ((format (printf, 2, 3)));
+        size_t      printf_P(const char* format, ...);
+        size_t      print(const char* str) {return write(str);}
+        size_t      print(const String& str) {return write(str.c_str());}
+        size_t      println(const char* str) {return write(str) + write("\r\n");}
+        size_t      println() {return write("\r\n");}
+
+    protected:
+        size_t      vprintf(const char* format, va_list args);
+};
+
+class HardwareSerial: public Print {
+    public:
+        size_t      write(uint8_t c) {return fputc(c, stdout) == EOF ? 0 : 1;}
+        size_t      write(const uint8_t* buffer, size_t size) {return fwrite(buffer, 1, size, stdout);}
+        using Print::write;
+};
+
+extern HardwareSerial Serial;
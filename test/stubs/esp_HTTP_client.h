@@ -0,0 +1,100 @@
+#pragma once
+/***********************************************************************************
+    Host stand-in for the subset of ESP-IDF esp_http_client that the library uses.
+    Declarations follow esp_http_client.h, the implementation is the fake
+    server in test/fake/fakeServer.cpp.
+***********************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_HTTP_BASE               0x7000
+#define ESP_ERR_HTTP_MAX_REDIRECT       (ESP_ERR_HTTP_BASE + 1)
+#define ESP_ERR_HTTP_CONNECT            (ESP_ERR_HTTP_BASE + 2)
+#define ESP_ERR_HTTP_WRITE_DATA         (ESP_ERR_HTTP_BASE + 3)
+#define ESP_ERR_HTTP_FETCH_HEADER       (ESP_ERR_HTTP_BASE + 4)
+#define ESP_ERR_HTTP_INVALID_TRANSPORT  (ESP_ERR_HTTP_BASE + 5)
+#define ESP_ERR_HTTP_CONNECTING         (ESP_ERR_HTTP_BASE + 6)
+#define ESP_ERR_HTTP_EAGAIN             (ESP_ERR_HTTP_BASE + 7)
+
+typedef struct esp_http_client* esp_http_client_handle_t;
+
+typedef enum {
+    HTTP_METHOD_GET = 0,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_MAX,
+} esp_http_client_method_t;
+
+typedef enum {
+    HTTP_EVENT_ERROR = 0,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_HEADER_SENT = HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void*       data;
+    int         data_len;
+    void*       user_data;
+    char*       header_key;
+    char*       header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t* evt);
+
+typedef struct {
+    const char* url;
+    const char* host;
+    int         port;
+    const char* username;
+    const char* password;
+    const char* path;
+    const char* query;
+    const char* cert_pem;
+    size_t      cert_len;
+    esp_http_client_method_t method;
+    int         timeout_ms;
+    bool        disable_auto_redirect;
+    int         max_redirection_count;
+    http_event_handle_cb event_handler;
+    void*       user_data;
+    int         buffer_size;
+    int         buffer_size_tx;
+    bool        is_async;
+    bool        use_global_ca_store;
+    bool        keep_alive_enable;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config);
+esp_err_t   esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t   esp_http_client_set_url(esp_http_client_handle_t client, const char* url);
+esp_err_t   esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len);
+esp_err_t   esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value);
+esp_err_t   esp_http_client_delete_header(esp_http_client_handle_t client, const char* key);
+esp_err_t   esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+esp_err_t   esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms);
+esp_err_t   esp_http_client_set_user_data(esp_http_client_handle_t client, void* data);
+esp_err_t   esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int         esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len);
+int         esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int         esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len);
+bool        esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+bool        esp_http_client_is_complete_data_received(esp_http_client_handle_t client);
+int         esp_http_client_get_status_code(esp_http_client_handle_t client);
+int         esp_http_client_get_content_length(esp_http_client_handle_t client);
+esp_err_t   esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t   esp_http_client_cleanup(esp_http_client_handle_t client);
+const char* esp_err_to_name(esp_err_t code);
@@ -0,0 +1,10 @@
+#pragma once
+// Host stand-in: flash and RAM are the same address space.
+#define PROGMEM
+#define PGM_P           const char*
+#define PSTR(s)         (s)
+#define strlen_P        strlen
+#define strcpy_P        strcpy
+#define strcmp_P        strcmp
+#define strcasecmp_P    strcasecmp
+#define memcpy_P        memcpy
@@ -0,0 +1,61 @@
+#pragma once
+/***********************************************************************************
+    Minimal test runner for the host tests. Each test file defines TEST()s and
+    ends with TEST_MAIN(). A failed CHECK reports file and line, marks the test
+    failed and carries on, so one run shows every failure.
+***********************************************************************************/
+#include <stdio.h>
+#include <vector>
+
+struct testCase {
+    const char* name;
+    void        (*run)();
+};
+
+inline std::vector<testCase>& testCases(){
+    static std::vector<testCase> cases;
+    return cases;
+}
+
+inline int& testFailures(){
+    static int failures = 0;
+    return failures;
+}
+
+struct testRegister {
+    testRegister(const char* name, void (*run)()) {testCases().push_back({name, run});}
+};
+
+#define TEST(name) \
+    static void test_##name(); \
+    static testRegister register_##name(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(cond) do { \
+    if( ! (cond)){ \
+        printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        testFailures()++; \
+    } \
+} while(0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _a = (long long)(a), _b = (long long)(b); \
+    if(_a != _b){ \
+        printf("  %s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+        testFailures()++; \
+    } \
+} while(0)
+
+#define TEST_MAIN() \
+    int main(){ \
+        int failed = 0; \
+        for(auto& test : testCases()){ \
+            int before = testFailures(); \
+            test.run(); \
+            bool ok = testFailures() == before; \
+            printf("%s %s\n", ok ? "PASS" : "FAIL", test.name); \
+            failed += ok ? 0 : 1; \
+        } \
+        printf("%d of %d tests failed\n", failed, (int) testCases().size()); \
+        return failed ? 1 : 0; \
+    }
@@ -0,0 +1,88 @@
+#include <test.h>
+#include <esp32HTTPbatcher.h>
+#include <fakeServer.h>
+#include <thread>
+
+TEST(flush_on_count_keeps_failed_batch){
+    fakeServer::reset();
+    esp32HTTPbatcher batcher("http://example.com/write");
+    batcher.setFlush(0, 3, 0);
+    CHECK(batcher.add("a=1"));
+    CHECK(batcher.add("b=2"));
+    batcher.poll();
+    CHECK_EQ(fakeServer::requestCount(), 0);
+    CHECK(batcher.add("c=3"));
+    fakeServer::respond(fakeResponse::fixed("busy", 503));
+    batcher.poll();
+    CHECK_EQ(batcher.lastHTTPcode(), 503);
+    CHECK_EQ(batcher.pendingRecords(), 3);
+    CHECK(batcher.flush());
+    CHECK_EQ(batcher.pendingRecords(), 0);
+    CHECK_EQ(batcher.pending(), 0);
+    CHECK(fakeServer::lastRequest().body == "a=1\nb=2\nc=3\n");
+    CHECK(strcmp(fakeServer::lastRequest().header("Content-Type"), "text/plain") == 0);
+}
+
+TEST(flush_when_idle){
+    fakeServer::reset();
+    esp32HTTPbatcher batcher("http://example.com/write");
+    batcher.setFlush(0, 0, 0, 100);
+    batcher.add("a=1");
+    delay(50);
+    batcher.add("b=2");
+    delay(60);
+    batcher.poll();
+    CHECK_EQ(fakeServer::requestCount(), 0);
+    delay(60);
+    batcher.poll();
+    CHECK_EQ(fakeServer::requestCount(), 1);
+    CHECK_EQ(batcher.pendingRecords(), 0);
+}
+
+//  The server closes the kept connection between flushes. The body comes
+//  from a callback, which the request can't resend, so the batcher does.
+
+TEST(resend_after_idle_connection_dropped){
+    fakeServer::reset();
+    esp32HTTPbatcher batcher("http://example.com/write");
+    batcher.add("a=1");
+    CHECK(batcher.flush());
+    fakeServer::dropIdle();
+    int connects = fakeServer::connects();
+    batcher.add("b=2");
+    CHECK(batcher.flush());
+    CHECK_EQ(batcher.lastHTTPcode(), 200);
+    CHECK_EQ(batcher.pendingRecords(), 0);
+    CHECK_EQ(fakeServer::connects(), connects + 1);
+    CHECK(fakeServer::lastRequest().body == "b=2\n");
+    CHECK(fakeServer::lastRequest().newConnection);
+}
+
+//  Records added while a flush is in progress age from when the first of
+//  them was added, not the last.
+
+TEST(age_of_records_added_during_flush){
+    fakeServer::reset();
+    esp32HTTPbatcher batcher("http://example.com/write");
+    batcher.setFlush(0, 0, 400);
+    batcher.add("a=1");
+    fakeServer::respond(fakeResponse::drip("ok", 1, 150));
+    std::thread flusher([&]{batcher.flush();});
+    delay(50);
+    batcher.add("b=2");
+    uint32_t added = millis();
+    delay(200);
+    batcher.add("c=3");
+    flusher.join();
+    CHECK_EQ(batcher.pendingRecords(), 2);
+    while(batcher.pendingRecords() && millis() - added < 1000){
+        batcher.poll();
+        delay(5);
+    }
+    uint32_t age = millis() - added;
+    CHECK_EQ(batcher.pendingRecords(), 0);
+    CHECK(age >= 400 && age < 550);
+    CHECK(fakeServer::lastRequest().body == "b=2\nc=3\n");
+}
+
+TEST_MAIN()
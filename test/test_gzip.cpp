@@ -0,0 +1,61 @@
+#include <test.h>
+#include <data.h>
+#include <fakeServer.h>
+#include <gunzip.h>
+#include <xgzip.h>
+
+//  xgzip output is checked by inflating it with zlib, when zlib is available.
+
+static std::string compress(const std::string& text, uint16_t window, size_t piece){
+    xbuf out(256, 1440);
+    xgzip gzip(&out, window);
+    CHECK(gzip.ok());
+    for(size_t pos = 0; pos < text.size(); pos += piece){
+        size_t len = text.size() - pos < piece ? text.size() - pos : piece;
+        CHECK_EQ(gzip.write((const uint8_t*) text.data() + pos, len), len);
+    }
+    size_t zlen = gzip.finish();
+    CHECK_EQ(gzip.in(), text.size());
+    CHECK_EQ(zlen, out.available());
+    std::string zipped(out.available(), 0);
+    out.read((uint8_t*) &zipped[0], zipped.size());
+    return zipped;
+}
+
+#ifdef HAVE_ZLIB
+static void roundTrip(const std::string& text, uint16_t window, size_t piece){
+    std::string zipped = compress(text, window, piece);
+    bool complete;
+    CHECK(gunzip(zipped, &complete) == text);
+    CHECK(complete);
+}
+#endif
+
+TEST(round_trip){
+#ifdef HAVE_ZLIB
+    roundTrip("", 2048, 1);
+    roundTrip("a", 2048, 1);
+    roundTrip(std::string(100000, 'x'), 2048, 1440);
+    for(uint16_t window : {512, 2048, 16384}){
+        for(size_t piece : {1, 7, 1440, 65536}){
+            roundTrip(lineProtocol(50000, window), window, piece);
+            roundTrip(csvRows(20000), window, piece);
+            roundTrip(fakeServer::pattern(30000, piece), window, piece);
+        }
+    }
+    roundTrip(jsonObjects(1 << 20), 2048, 1000);
+#else
+    printf("  zlib not found, round trip not checked\n");
+#endif
+}
+
+TEST(ratio){
+    std::string text = lineProtocol(100000);
+    std::string zipped = compress(text, 2048, 1440);
+    CHECK(zipped.size() < text.size() / 3);
+    xbuf out;
+    xgzip gzip(&out, 2048);
+    CHECK(gzip.memory() > 10000 && gzip.memory() < 11000);
+}
+
+TEST_MAIN()
@@ -0,0 +1,813 @@
+#include <test.h>
+#include <esp32HTTPrequest.h>
+#include <fakeServer.h>
+#include <data.h>
+#include <gunzip.h>
+#include <atomic>
+#include <thread>
+
+//  Runs first, before any request has created the async workers. Tasks
+//  turning async on at the same time create them only once.
+
+TEST(async_workers_created_once){
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for(int i=0; i<8; i++){
+        threads.emplace_back([&go]{
+            esp32HTTPrequest request;
+            while( ! go) ;
+            request.async(true);
+        });
+    }
+    go = true;
+    for(auto& thread : threads){
+        thread.join();
+    }
+    CHECK_EQ(hostTasksCreated, ESP32_HTTP_REQUEST_ASYNC_TASKS);
+}
+
+TEST(get_fixed){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::fixed("hello world"));
+    esp32HTTPrequest request;
+    CHECK(request.open("GET", "http://example.com/path?x=1"));
+    CHECK(request.send());
+    CHECK_EQ(request.readyState(), 4);
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(request.responseText() == "hello world");
+    fakeRequest sent = fakeServer::lastRequest();
+    CHECK(sent.method == "GET");
+    CHECK(sent.url == "http://example.com/path?x=1");
+    CHECK(sent.header("host") && strcmp(sent.header("host"), "example.com") == 0);
+}
+
+TEST(response_without_memory){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::fixed(fakeServer::pattern(4000, 3)));
+    esp32HTTPrequest request;
+    CHECK(request.open("GET", "http://example.com/big"));
+    hostMallocFail = 1000;
+    request.send();
+    hostMallocFail = 0;
+    CHECK_EQ(request.readyState(), 4);
+    CHECK_EQ(request.responseHTTPcode(), HTTPCODE_TOO_LESS_RAM);
+}
+
+TEST(get_chunked){
+    fakeServer::reset();
+    std::string body = fakeServer::pattern(5000, 2);
+    fakeServer::respond(fakeResponse::chunkedBody(body, 300));
+    esp32HTTPrequest request;
+    request.open("GET", "http://example.com/chunked");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(request.available(), body.size());
+    CHECK(std::string(request.responseText().c_str()) == body);
+}
+
+TEST(get_slow_drip){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::drip("drip drip drip drip", 3, 2));
+    esp32HTTPrequest request;
+    request.open("GET", "http://example.com/drip");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(request.responseText() == "drip drip drip drip");
+    CHECK(request.timings().finished >= 10000);
+}
+
+TEST(get_huge_random_pieces){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::huge(1 << 20, 3));
+    esp32HTTPrequest request;
+    request.open("GET", "http://example.com/huge");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    std::string expect = fakeServer::pattern(1 << 20, 3);
+    std::string got;
+    uint8_t buf[777];
+    size_t len;
+    while((len = request.responseRead(buf, sizeof(buf)))){
+        got.append((char*) buf, len);
+    }
+    CHECK(got == expect);
+}
+
+//  Several MB through _response, arriving in random size ON_DATA pieces and
+//  read in random sizes, both as it arrives (onData) and after it completes.
+
+struct stressReader {
+    std::string got;
+    uint32_t    random = 7;
+
+    size_t      next(size_t limit){
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return 1 + random % limit;
+    }
+    void        read(esp32HTTPrequest* request){
+        uint8_t buf[5000];
+        size_t len = request->responseRead(buf, next(sizeof(buf)));
+        got.append((char*) buf, len);
+    }
+    static void onData(void* arg, esp32HTTPrequest* request, size_t){
+        ((stressReader*) arg)->read(request);
+    }
+};
+
+TEST(stress_multi_megabyte_response){
+    const size_t len = 6 << 20;
+    std::string expect = fakeServer::pattern(len, 11);
+    for(bool chunked : {false, true}){
+        for(bool whileLoading : {false, true}){
+            fakeServer::reset();
+            fakeResponse response = fakeResponse::huge(len, 11);
+            response.chunked = chunked;
+            fakeServer::respond(response);
+            esp32HTTPrequest request;
+            stressReader reader;
+            request.open("GET", "http://example.com/stress");
+            if(whileLoading){
+                request.onData(stressReader::onData, &reader);
+            }
+            request.send();
+            CHECK_EQ(request.responseHTTPcode(), 200);
+            CHECK_EQ(request.responseLength(), len);
+            if( ! whileLoading){
+                CHECK_EQ(request.available(), len);
+            }
+            while(request.available()){
+                reader.read(&request);
+            }
+            CHECK_EQ(reader.got.size(), len);
+            CHECK(reader.got == expect);
+        }
+    }
+}
+
+TEST(pool_recycles_response_segments){
+    xbuf::segPool(64, 256);
+    size_t before = 0;
+    for(int i=0; i<10; i++){
+        if(i == 2){
+            before = hostMallocCount;
+        }
+        fakeServer::reset();
+        fakeServer::respond(fakeResponse::fixed(fakeServer::pattern(5000 + i * 100, 4)));
+        fakeServer::respond(fakeResponse::chunkedBody(fakeServer::pattern(7000, 5), 700));
+        fakeServer::respond(fakeResponse::fixed("short"));
+        for(int j=0; j<3; j++){
+            esp32HTTPrequest request;
+            request.open("GET", "http://example.com/pooled");
+            request.send();
+            CHECK_EQ(request.responseHTTPcode(), 200);
+        }
+    }
+    CHECK_EQ(hostMallocCount - before, 0);
+    xbuf::segPool(64, 0);
+}
+
+//  With setMaxBuffer() the read stalls at the limit while send() holds the
+//  request, and another task reading the response lets it continue.
+
+TEST(max_buffer_drained_by_other_task){
+    fakeServer::reset();
+    const size_t len = 200000;
+    fakeServer::respond(fakeResponse::huge(len, 6));
+    esp32HTTPrequest request;
+    request.open("GET", "http://example.com/stall");
+    request.setMaxBuffer(4096);
+    std::atomic<bool> done(false);
+    std::string got;
+    std::thread reader([&]{
+        uint8_t buf[1000];
+        while( ! done){
+            size_t read = request.responseRead(buf, sizeof(buf));
+            got.append((char*) buf, read);
+            if( ! read) delay(1);
+        }
+    });
+    uint32_t start = millis();
+    request.send();
+    done = true;
+    reader.join();
+    uint8_t buf[1000];
+    size_t read;
+    while((read = request.responseRead(buf, sizeof(buf)))){
+        got.append((char*) buf, read);
+    }
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(got == fakeServer::pattern(len, 6));
+    CHECK(request.peakBuffered() <= 4096);
+    CHECK(millis() - start < 2000);
+}
+
+//  A sink receives the whole response as it arrives, nothing is buffered.
+
+TEST(response_sink){
+    fakeServer::reset();
+    std::string text = fakeServer::pattern(50000, 7);
+    fakeServer::respond(fakeResponse::huge(50000, 7));
+    struct collector : public Print {
+        std::string got;
+        size_t  write(uint8_t c) override {got += (char) c; return 1;}
+        size_t  write(const uint8_t* buf, size_t len) override {got.append((const char*) buf, len); return len;}
+    } print;
+    esp32HTTPrequest request;
+    request.responseSink(&print);
+    request.open("GET", "http://example.com/sink");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(print.got == text);
+    CHECK_EQ(request.available(), 0);
+
+            // A callback taking at most 100 bytes at a time is offered the
+            // rest until it has it all.
+
+    std::string got;
+    fakeServer::respond(fakeResponse::chunkedBody(text, 1000));
+    request.responseSink([](void* arg, esp32HTTPrequest*, const uint8_t* data, size_t len)->size_t{
+        len = std::min<size_t>(len, 100);
+        ((std::string*) arg)->append((const char*) data, len);
+        return len;
+    }, &got);
+    request.open("GET", "http://example.com/sink");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(got == text);
+    CHECK_EQ(request.available(), 0);
+
+            // A sink that takes nothing fails the response after the timeout.
+
+    fakeServer::respond(fakeResponse::fixed(text));
+    request.responseSink([](void*, esp32HTTPrequest*, const uint8_t*, size_t)->size_t{
+        return 0;
+    }, nullptr);
+    request.setTimeout(1);
+    uint32_t start = millis();
+    request.open("GET", "http://example.com/sink");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), HTTPCODE_STREAM_WRITE);
+    CHECK_EQ(request.available(), 0);
+    CHECK(millis() - start >= 1000 && millis() - start < 3000);
+}
+
+TEST(send_batch){
+    fakeServer::reset();
+    for(int i=0; i<5; i++){
+        fakeServer::respond(fakeResponse::fixed(std::to_string(i), 200 + i));
+    }
+    esp32HTTPrequest::batchRequest batch[5];
+    std::string bodies[5];
+    for(int i=0; i<5; i++){
+        bodies[i] = "reading=" + std::to_string(i);
+        batch[i] = {"POST", "http://example.com/batch", bodies[i].c_str(), bodies[i].size(), "text/plain"};
+    }
+    struct results {
+        std::vector<std::string> responses;
+        std::vector<int>    codes;
+        int                 done = 0;
+        size_t              sent = 0;
+        size_t              stopAfter = 5;
+    } got;
+    auto each = [](void* arg, esp32HTTPrequest* request, size_t index){
+        results* got = (results*) arg;
+        CHECK_EQ(index, got->codes.size());
+        got->codes.push_back(request->responseHTTPcode());
+        got->responses.push_back(request->responseText().c_str());
+        return got->codes.size() < got->stopAfter;
+    };
+    auto done = [](void* arg, esp32HTTPrequest*, size_t sent){
+        ((results*) arg)->done++;
+        ((results*) arg)->sent = sent;
+    };
+    esp32HTTPrequest request;
+    CHECK_EQ(request.sendBatch(batch, 5, each, &got, done), 5);
+    CHECK_EQ(got.done, 1);
+    CHECK_EQ(got.sent, 5);
+    for(int i=0; i<5; i++){
+        CHECK_EQ(got.codes[i], 200 + i);
+        CHECK(got.responses[i] == std::to_string(i));
+    }
+    std::vector<fakeRequest> sent = fakeServer::requests();
+    CHECK_EQ(sent.size(), 5);
+    for(size_t i=0; i<sent.size(); i++){
+        CHECK(sent[i].body == bodies[i]);
+        CHECK_EQ(sent[i].connection, sent[0].connection);
+    }
+
+            // Stopping early still ends the batch with one done call.
+
+    fakeServer::reset();
+    got = results();
+    got.stopAfter = 2;
+    CHECK_EQ(request.sendBatch(batch, 5, each, &got, done), 2);
+    CHECK_EQ(got.done, 1);
+    CHECK_EQ(got.sent, 2);
+    CHECK_EQ(fakeServer::requestCount(), 2);
+
+            // The connection drops partway through the third response. It
+            // isn't counted, and the batch stops there.
+
+    fakeServer::reset();
+    got = results();
+    fakeServer::respond(fakeResponse::fixed("0", 200));
+    fakeServer::respond(fakeResponse::fixed("1", 201));
+    fakeResponse dropped = fakeResponse::fixed("partial response");
+    dropped.dropAfter = 4;
+    fakeServer::respond(dropped);
+    CHECK_EQ(request.sendBatch(batch, 5, each, &got, done), 2);
+    CHECK_EQ(got.done, 1);
+    CHECK_EQ(got.sent, 2);
+    CHECK_EQ(got.codes.size(), 2);
+    CHECK_EQ(request.responseHTTPcode(), HTTPCODE_PERFORM_FAILED);
+    CHECK_EQ(fakeServer::requestCount(), 3);
+}
+
+TEST(replay_raw){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::fromRaw(
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Type: text/plain\r\n"
+        "ETag: \"abc\"\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "5\r\nnope!\r\n0\r\n\r\n"));
+    esp32HTTPrequest request;
+    request.open("GET", "http://example.com/missing");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 404);
+    CHECK(request.respContentType() && strcmp(request.respContentType(), "text/plain") == 0);
+    CHECK(request.respETag() && strcmp(request.respETag(), "\"abc\"") == 0);
+    CHECK(request.responseText() == "nope!");
+
+            // Repeated headers are joined, Set-Cookie is kept per line.
+
+    fakeServer::respond(fakeResponse::fromRaw(
+        "HTTP/1.1 200 OK\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Set-Cookie: a=1; Path=/\r\n"
+        "Content-Length: 2\r\n"
+        "Cache-Control: no-store\r\n"
+        "Set-Cookie: b=2\r\n"
+        "Cache-Control: private\r\n"
+        "\r\n"
+        "ok"));
+    request.open("GET", "http://example.com/cookies");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(request.respHeaderCount(), 4);
+    CHECK(strcmp(request.respHeaderValue("cache-control"), "no-cache, no-store, private") == 0);
+    CHECK(strcmp(request.respHeaderValue("Set-Cookie"), "a=1; Path=/") == 0);
+    int cookies = 0;
+    for(int i=0; i<request.respHeaderCount(); i++){
+        if(strcasecmp(request.respHeaderName(i), "Set-Cookie") == 0){
+            CHECK(strcmp(request.respHeaderValue(i), cookies ? "b=2" : "a=1; Path=/") == 0);
+            cookies++;
+        }
+    }
+    CHECK_EQ(cookies, 2);
+    CHECK(request.headers().c_str() && strstr(request.headers().c_str(), "b=2"));
+}
+
+//  Headers not in the keepRespHeaders() list are dropped without taking
+//  arena space. X-Keep-742177 and X-Keep-1291100 have the same hash.
+
+TEST(keep_resp_headers){
+    std::string raw = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nETag: \"e1\"\r\nX-Keep-1291100: dropped\r\n";
+    for(int i=0; i<20; i++){
+        raw += "X-Filler-" + std::to_string(i) + ": " + std::string(200, 'f') + "\r\n";
+    }
+    raw += "X-Keep-742177: kept\r\n\r\nok";
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::fromRaw(raw));
+    uint32_t all;
+    {
+        esp32HTTPrequest request;
+        request.open("GET", "http://example.com/headers");
+        request.send();
+        CHECK_EQ(request.respHeaderCount(), 24);
+        all = request.allocations().peak;
+    }
+    fakeServer::respond(fakeResponse::fromRaw(raw));
+    esp32HTTPrequest request;
+    CHECK(request.keepRespHeaders({"etag", "X-Keep-742177"}));
+    request.open("GET", "http://example.com/headers");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(request.respHeaderCount(), 2);
+    CHECK(request.respETag() && strcmp(request.respETag(), "\"e1\"") == 0);
+    CHECK(request.respHeaderValue("X-Keep-742177") && strcmp(request.respHeaderValue("X-Keep-742177"), "kept") == 0);
+    CHECK( ! request.respHeaderExists("X-Keep-1291100"));
+    CHECK(request.allocations().peak + 4000 <= all);
+    CHECK(request.responseText() == "ok");
+}
+
+TEST(post_bodies){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    request.open("POST", "http://example.com/post");
+    request.setReqHeader("Content-Type", "text/plain");
+    request.send(String("string body"));
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(fakeServer::lastRequest().body == "string body");
+    CHECK(fakeServer::lastRequest().method == "POST");
+
+    xbuf body;
+    std::string text = fakeServer::pattern(4000, 4);
+    body.write((const uint8_t*) text.data(), text.size());
+    request.open("POST", "http://example.com/post");
+    request.send(&body, body.available());
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK(fakeServer::lastRequest().streamed);
+
+    struct provider {
+        std::string text;
+        size_t pos = 0;
+    } source{text};
+    request.open("POST", "http://example.com/post");
+    request.send([](void* arg, esp32HTTPrequest*, uint8_t* buf, size_t len)->size_t{
+        provider* source = (provider*) arg;
+        len = std::min(len, std::min<size_t>(100, source->text.size() - source->pos));
+        memcpy(buf, source->text.data() + source->pos, len);
+        source->pos += len;
+        return len;
+    }, HTTP_REQUEST_CHUNKED, &source);
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK(fakeServer::lastRequest().header("Transfer-Encoding") != nullptr);
+}
+
+//  A String body is sent from the caller's String, async moves it in.
+
+TEST(string_body_not_copied){
+    fakeServer::reset();
+    std::string text = fakeServer::pattern(6000, 5);
+    String body(text.c_str());
+    esp32HTTPrequest request;
+    String::copies = 0;
+    request.open("POST", "http://example.com/post");
+    CHECK(request.send(body));
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK_EQ(String::copies, 0);
+
+    request.async(true);
+    std::atomic<bool> done{false};
+    request.onReadyStateChange([](void* arg, esp32HTTPrequest*, int readyState){
+        if(readyState == 4) *(std::atomic<bool>*) arg = true;
+    }, &done);
+    request.open("POST", "http://example.com/post");
+    CHECK(request.send(std::move(body)));
+    while( ! done) delay(1);
+    CHECK(request.open("GET", "http://example.com/"));
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK_EQ(String::copies, 0);
+    request.onReadyStateChange(nullptr);
+}
+
+TEST(keep_alive_reuse){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    for(int i=0; i<3; i++){
+        request.open("GET", "http://reuse.example.com/a");
+        request.send();
+        CHECK_EQ(request.responseHTTPcode(), 200);
+    }
+    CHECK_EQ(fakeServer::connects(), 1);
+    CHECK_EQ(fakeServer::misuse(), 0);
+}
+
+TEST(async_caller_never_blocks){
+    fakeServer::reset();
+    fakeServer::respond(fakeResponse::drip(fakeServer::pattern(100), 5, 5));
+    struct state {
+        std::atomic<bool> done{false};
+        std::atomic<uint32_t> hookFinished{0};
+        std::atomic<uint32_t> hookStart{0};
+    };
+    static state seen;
+    esp32HTTPrequest::onTimings([](esp32HTTPrequest*, const esp32HTTPrequest::requestTimings& timings){
+        seen.hookStart = timings.start;
+        seen.hookFinished = timings.finished;
+    });
+    esp32HTTPrequest request;
+    request.async(true);
+    request.onReadyStateChange([](void* arg, esp32HTTPrequest*, int readyState){
+        if(readyState == 4) ((state*) arg)->done = true;
+    }, &seen);
+    uint32_t start = micros();
+    CHECK(request.open("GET", "http://async.example.com/slow"));
+    uint32_t timingsStart = request.timings().start;
+    CHECK(request.send());
+    CHECK(micros() - start < 20000);
+    CHECK(request.readyState() != 4);
+    while( ! seen.done) delay(1);
+
+            // Done is signaled before the worker has finished with the
+            // request, open() waits for it rather than resetting the
+            // timings the hook is about to see.
+
+    CHECK(request.open("GET", "http://async.example.com/again"));
+    CHECK_EQ(seen.hookStart, timingsStart);
+    CHECK(seen.hookFinished >= 100000);
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    esp32HTTPrequest::onTimings(nullptr);
+}
+
+TEST(pooled_headers_do_not_leak){
+    fakeServer::reset();
+    {
+        esp32HTTPrequest first;
+        first.open("POST", "http://pool.example.com/login");
+        first.setReqHeader("Authorization", "Bearer secret");
+        first.setReqHeader("Content-Type", "application/json");
+        first.send(String("{}"));
+        CHECK(fakeServer::lastRequest().header("Authorization") != nullptr);
+    }
+    esp32HTTPrequest second;
+    second.open("GET", "http://pool.example.com/public");
+    second.send();
+    fakeRequest sent = fakeServer::lastRequest();
+    CHECK( ! sent.newConnection);
+    CHECK(sent.header("Authorization") == nullptr);
+    CHECK(sent.header("Content-Type") == nullptr);
+    CHECK(sent.header("host") != nullptr);
+    CHECK_EQ(fakeServer::connects(), 1);
+}
+
+TEST(close_idle_connections){
+    fakeServer::reset();
+    delay(300);
+    esp32HTTPrequest::closeIdle();
+    int live = fakeServer::liveHandles();
+    {
+        esp32HTTPrequest request;
+        request.open("GET", "http://idle.example.com/");
+        request.send();
+    }
+    CHECK_EQ(fakeServer::liveHandles(), live + 1);
+    esp32HTTPrequest::closeIdle();
+    CHECK_EQ(fakeServer::liveHandles(), live + 1);
+    delay(300);
+    esp32HTTPrequest::closeIdle();
+    CHECK_EQ(fakeServer::liveHandles(), live);
+}
+
+TEST(retry_when_idle_connection_dropped){
+    fakeServer::reset();
+    uint32_t handshakes = esp32HTTPrequest::tlsHandshakes();
+    uint32_t reused = esp32HTTPrequest::tlsReused();
+    esp32HTTPrequest request;
+    request.open("POST", "https://retry.example.com/a");
+    request.send(String("first"));
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(esp32HTTPrequest::tlsHandshakes(), handshakes + 1);
+    fakeServer::dropIdle();
+    fakeServer::respond(fakeResponse::fixed("second response"));
+    request.open("POST", "https://retry.example.com/a");
+    request.send(String("second"));
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(request.responseText() == "second response");
+    CHECK_EQ(fakeServer::connects(), 2);
+    CHECK_EQ(fakeServer::requestCount(), 2);
+    CHECK(fakeServer::lastRequest().body == "second");
+    CHECK_EQ(esp32HTTPrequest::tlsHandshakes(), handshakes + 2);
+    CHECK_EQ(esp32HTTPrequest::tlsReused(), reused);
+    request.open("GET", "https://retry.example.com/b");
+    request.send();
+    CHECK_EQ(esp32HTTPrequest::tlsReused(), reused + 1);
+}
+
+//  Sends on kept-alive HTTPS connections still take TLSlock_S, so no more
+//  than ESP32_HTTP_REQUEST_MAX_TLS (1) run at once.
+
+TEST(tls_reuse_respects_max_tls){
+    fakeServer::reset();
+    fakeServer::setDefault(fakeResponse::drip("slow", 2, 40));
+    struct window {
+        std::atomic<int>    active{0};
+        std::atomic<int>    peak{0};
+        static void cb(void* arg, esp32HTTPrequest*, int readyState){
+            window* w = (window*) arg;
+            if(readyState == 2){
+                int now = ++w->active;
+                int peak = w->peak;
+                while(now > peak && ! w->peak.compare_exchange_weak(peak, now));
+            }
+            if(readyState == 4) w->active--;
+        }
+    } w;
+    auto client = [&w]{
+        esp32HTTPrequest request;
+        request.onReadyStateChange(window::cb, &w);
+        for(int i=0; i<3; i++){
+            request.open("GET", "https://tls.example.com/x");
+            request.send();
+            CHECK_EQ(request.responseHTTPcode(), 200);
+        }
+    };
+    uint32_t reused = esp32HTTPrequest::tlsReused();
+    std::thread a(client), b(client);
+    a.join();
+    b.join();
+    fakeServer::reset();
+    CHECK(esp32HTTPrequest::tlsReused() > reused);
+    CHECK_EQ(w.peak, 1);
+}
+
+//  Only ESP32_HTTP_REQUEST_MAX_TLS (1) idle HTTPS connections are kept,
+//  plain HTTP connections aren't limited by it.
+
+TEST(idle_tls_connections_limited){
+    delay(300);
+    esp32HTTPrequest::closeIdle();
+    fakeServer::reset();
+    int live = fakeServer::liveHandles();
+    const char* urls[] = {"https://a.tls.example.com/", "https://b.tls.example.com/",
+                          "http://a.plain.example.com/", "http://b.plain.example.com/"};
+    for(const char* url : urls){
+        esp32HTTPrequest request;
+        request.open("GET", url);
+        request.send();
+        CHECK_EQ(request.responseHTTPcode(), 200);
+    }
+    CHECK_EQ(fakeServer::liveHandles(), live + 3);
+    CHECK_EQ(fakeServer::connects(), 4);
+    for(const char* url : urls){
+        esp32HTTPrequest request;
+        request.open("GET", url);
+        request.send();
+    }
+
+            // Each HTTPS connection closed the other when it was checked in,
+            // both plain connections were reused.
+
+    CHECK_EQ(fakeServer::connects(), 6);
+}
+
+TEST(no_retry_after_response_started){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    request.open("GET", "http://noretry.example.com/a");
+    request.send();
+    fakeResponse broken = fakeResponse::fixed(fakeServer::pattern(1000));
+    broken.dropAfter = 300;
+    broken.piece = 100;
+    fakeServer::respond(broken);
+    request.open("POST", "http://noretry.example.com/a");
+    request.send(String("only once"));
+    CHECK_EQ(request.responseHTTPcode(), HTTPCODE_PERFORM_FAILED);
+    CHECK_EQ(fakeServer::requestCount(), 2);
+    CHECK_EQ(request.readyState(), 4);
+
+    fakeResponse dropped;
+    dropped.drop = true;
+    fakeServer::respond(dropped);
+    fakeServer::respond(fakeResponse::fixed("after drop"));
+    request.open("GET", "http://noretry.example.com/a");
+    request.send();
+    request.open("GET", "http://noretry.example.com/a");
+    request.send();
+    CHECK(request.responseText() == "after drop");
+}
+
+TEST(streamed_body_keeps_connection){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    std::string text = fakeServer::pattern(3000, 6);
+    xbuf body;
+    body.write((const uint8_t*) text.data(), text.size());
+    request.open("POST", "http://stream.example.com/post");
+    request.send(&body, body.available());
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(body.available(), 0);
+
+            // Requests that follow on the connection, with or without
+            // a body, must not go through perform.
+
+    fakeServer::respond(fakeResponse::chunkedBody(fakeServer::pattern(2000, 7), 500));
+    request.open("GET", "http://stream.example.com/get");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(std::string(request.responseText().c_str()) == fakeServer::pattern(2000, 7));
+    request.open("POST", "http://stream.example.com/post");
+    request.send(String("contiguous"));
+    CHECK(fakeServer::lastRequest().body == "contiguous");
+    request.open("POST", "http://stream.example.com/post");
+    body.write((const uint8_t*) text.data(), text.size());
+    request.send(&body, body.available());
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK_EQ(fakeServer::connects(), 1);
+    CHECK_EQ(fakeServer::misuse(), 0);
+
+            // A streamed request on a connection the server closed while
+            // idle is sent again, the xbuf body is only consumed at the end.
+
+    fakeServer::dropIdle();
+    body.write((const uint8_t*) text.data(), text.size());
+    request.open("POST", "http://stream.example.com/post");
+    request.send(&body, body.available());
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK(fakeServer::lastRequest().body == text);
+    CHECK_EQ(fakeServer::connects(), 2);
+
+            // Connection: close is honored.
+
+    fakeResponse closing = fakeResponse::fixed("bye");
+    closing.close = true;
+    fakeServer::respond(closing);
+    body.write((const uint8_t*) text.data(), text.size());
+    request.open("POST", "http://stream.example.com/post");
+    request.send(&body, body.available());
+    request.open("GET", "http://stream.example.com/get");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    CHECK_EQ(fakeServer::connects(), 3);
+    CHECK_EQ(fakeServer::misuse(), 0);
+}
+
+TEST(compress_bodies){
+    fakeServer::reset();
+    std::string text = lineProtocol(200000);
+    esp32HTTPrequest request;
+    request.compress(true);
+
+            // A bodyProviderCB body is compressed as it is pulled and sent
+            // chunked, memory stays near the compressor's working set.
+
+    struct provider {
+        const std::string& text;
+        size_t pos;
+        size_t maxPiece;
+    } source{text, 0, 0};
+    auto pull = [](void* arg, esp32HTTPrequest*, uint8_t* buf, size_t len)->size_t{
+        provider* source = (provider*) arg;
+        len = std::min(len, source->text.size() - source->pos);
+        memcpy(buf, source->text.data() + source->pos, len);
+        source->pos += len;
+        return len;
+    };
+    request.open("POST", "http://gzip.example.com/write");
+    request.send(pull, HTTP_REQUEST_CHUNKED, &source);
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    fakeRequest sent = fakeServer::lastRequest();
+    CHECK(sent.header("Content-Encoding") && strcmp(sent.header("Content-Encoding"), "gzip") == 0);
+    CHECK(sent.header("Transfer-Encoding") != nullptr);
+    CHECK(sent.body.size() < text.size() / 3);
+    if(haveZlib()){
+        CHECK(gunzip(sent.body) == text);
+    }
+    CHECK(request.allocations().peak < 20000);
+
+            // Known length provider bodies are sent chunked too.
+
+    source.pos = 0;
+    request.open("POST", "http://gzip.example.com/write");
+    request.send(pull, text.size(), &source);
+    sent = fakeServer::lastRequest();
+    CHECK(sent.header("Transfer-Encoding") != nullptr);
+    CHECK(sent.header("Content-Length") == nullptr);
+    if(haveZlib()){
+        CHECK(gunzip(sent.body) == text);
+    }
+
+            // Contiguous and xbuf bodies keep a Content-Length, and are
+            // sent as is when they don't compress.
+
+    request.open("POST", "http://gzip.example.com/write");
+    request.send(text.c_str());
+    sent = fakeServer::lastRequest();
+    CHECK(sent.header("Content-Encoding") != nullptr);
+    CHECK(sent.header("Transfer-Encoding") == nullptr);
+    CHECK_EQ(atoi(sent.header("Content-Length")), sent.body.size());
+    if(haveZlib()){
+        CHECK(gunzip(sent.body) == text);
+    }
+    std::string random = fakeServer::pattern(3000, 9);
+    std::string binary(3000, 0);
+    for(size_t i=0; i<binary.size(); i++) binary[i] = (char)(random[i] * 131 + i * 7);
+    xbuf body;
+    body.write((const uint8_t*) binary.data(), binary.size());
+    request.open("POST", "http://gzip.example.com/write");
+    request.send(&body, body.available());
+    sent = fakeServer::lastRequest();
+    CHECK(sent.header("Content-Encoding") == nullptr);
+    CHECK(sent.body == binary);
+
+            // Compressed requests keep the connection and don't leave
+            // Content-Encoding behind for an uncompressed one.
+
+    request.compress(false);
+    request.open("POST", "http://gzip.example.com/write");
+    request.send(String("plain"));
+    sent = fakeServer::lastRequest();
+    CHECK(sent.header("Content-Encoding") == nullptr);
+    CHECK(sent.body == "plain");
+    CHECK_EQ(fakeServer::connects(), 1);
+    CHECK_EQ(fakeServer::misuse(), 0);
+}
+
+TEST_MAIN()
@@ -0,0 +1,75 @@
+#include <test.h>
+#include <esp32HTTPrequest.h>
+#include <fakeServer.h>
+#include <string>
+
+//  Built against hostlib_trace, with ESP32_HTTP_REQUEST_LOG=1.
+
+struct collector : public Print {
+    std::string got;
+    size_t  write(uint8_t c) override {got += (char) c; return 1;}
+    size_t  write(const uint8_t* buf, size_t len) override {got.append((const char*) buf, len); return len;}
+};
+
+static int lines(const std::string& text){
+    int count = 0;
+    for(char c : text){
+        if(c == '\n') count++;
+    }
+    return count;
+}
+
+TEST(trace_after_request){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    request.setDebug(true);
+    request.open("GET", "http://trace.example.com/path");
+    request.send();
+    CHECK_EQ(request.responseHTTPcode(), 200);
+    collector out;
+    esp32HTTPrequest::dumpTrace(out);
+    CHECK(out.got.find("setDebug(on) version") != std::string::npos);
+    CHECK(out.got.find("send()") != std::string::npos);
+
+            // String arguments are copied, truncated to 15 characters.
+
+    CHECK(out.got.find("open(GET, http://trace.ex)") != std::string::npos);
+    CHECK(out.got.find("trace.example.com/path") == std::string::npos);
+    CHECK(out.got.find("Trace(") == 0);
+
+            // Dumping empties the ring.
+
+    collector again;
+    esp32HTTPrequest::dumpTrace(again);
+    CHECK(again.got.empty());
+}
+
+TEST(trace_without_debug){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    request.open("GET", "http://trace.example.com/");
+    request.send();
+    collector out;
+    esp32HTTPrequest::dumpTrace(out);
+    CHECK(out.got.empty());
+}
+
+//  The ring keeps the last ESP32_HTTP_REQUEST_TRACE_DEPTH records.
+
+TEST(trace_ring_keeps_latest){
+    fakeServer::reset();
+    esp32HTTPrequest request;
+    request.setDebug(true);
+    for(int i=0; i<ESP32_HTTP_REQUEST_TRACE_DEPTH; i++){
+        request.setTimeout(100 + i);
+    }
+    request.setTimeout(1000);
+    collector out;
+    esp32HTTPrequest::dumpTrace(out);
+    CHECK_EQ(lines(out.got), ESP32_HTTP_REQUEST_TRACE_DEPTH);
+    CHECK(out.got.find("setTimeout(100)") == std::string::npos);
+    CHECK(out.got.find("setTimeout(101)") != std::string::npos);
+    CHECK(out.got.find("setTimeout(1000)") != std::string::npos);
+}
+
+TEST_MAIN()
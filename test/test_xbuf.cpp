@@ -0,0 +1,167 @@
+#include <test.h>
+#include <xbuf.h>
+
+TEST(write_read){
+    xbuf buf(16);
+    const char* text = "The quick brown fox jumps over the lazy dog";
+    CHECK_EQ(buf.write(text), strlen(text));
+    CHECK_EQ(buf.available(), strlen(text));
+    CHECK(buf.peekString() == text);
+    uint8_t out[64];
+    CHECK_EQ(buf.read(out, 4), 4);
+    CHECK(memcmp(out, "The ", 4) == 0);
+    CHECK(buf.readString() == text + 4);
+    CHECK_EQ(buf.available(), 0);
+}
+
+TEST(indexOf_across_segments){
+    xbuf buf(8);
+    buf.write("abcdefghijklmnopqrstuvwxyz");
+    CHECK_EQ(buf.indexOf('q'), 16);
+    CHECK_EQ(buf.indexOf("ghij"), 6);
+    CHECK_EQ(buf.indexOf("xyz"), 23);
+    CHECK_EQ(buf.indexOf("xyzz"), -1);
+    CHECK_EQ(buf.indexOf("efg", 5), -1);
+    CHECK(buf.readStringUntil("mno") == "abcdefghijklmno");
+}
+
+TEST(spans_consume){
+    xbuf buf(8);
+    buf.write("0123456789abcdefghij");
+    xspan spans[8];
+    size_t count = buf.spans(spans, 8);
+    size_t total = 0;
+    for(size_t i=0; i<count; i++) total += spans[i].len;
+    CHECK_EQ(total, 20);
+    CHECK(memcmp(spans[0].data, "01234567", spans[0].len < 8 ? spans[0].len : 8) == 0);
+    CHECK_EQ(buf.consume(12), 12);
+    CHECK(buf.peekString() == "cdefghij");
+    CHECK_EQ(buf.consume(100), 8);
+}
+
+TEST(write_xbuf_moves){
+    xbuf from(16), to(16);
+    from.write("segment moving test data, longer than a segment");
+    size_t len = from.available();
+    CHECK_EQ(to.write(&from, len), len);
+    CHECK_EQ(from.available(), 0);
+    CHECK(to.readString() == "segment moving test data, longer than a segment");
+}
+
+TEST(pool_recycles){
+    xbuf::segPool(32, 64);
+    {
+        xbuf warm(32, 256);
+        for(int i=0; i<8; i++) warm.write("0123456789012345678901234567890123456789");
+    }
+    size_t before = 0;
+    for(int i=0; i<100; i++){
+        if(i == 1) before = hostMallocCount;
+        xbuf buf(32);
+        buf.write("0123456789012345678901234567890123456789");
+        buf.consume(buf.available());
+    }
+    CHECK_EQ(hostMallocCount - before, 0);
+
+            // Sizes between classes round up to the next class,
+            // growing segments are recycled at each size.
+
+    before = hostMallocCount;
+    for(int i=0; i<100; i++){
+        xbuf buf(40, 256);
+        for(int j=0; j<8; j++) buf.write("0123456789012345678901234567890123456789");
+        CHECK(buf.readString().length() == 320);
+    }
+    CHECK_EQ(hostMallocCount - before, 0);
+
+            // Memory held is limited by the high-water mark.
+
+    xbuf::segPool(32, 4);
+    before = hostMallocCount;
+    {
+        xbuf buf(256);
+        buf.write("0123456789");
+    }
+    {
+        xbuf buf(256);
+        buf.write("0123456789");
+    }
+    CHECK_EQ(hostMallocCount - before, 2);
+    xbuf::segPool(32, 0);
+}
+
+TEST(stress_past_64K){
+    for(size_t maxSeg : {0, 4096}){
+        xbuf buf(64, maxSeg);
+        uint32_t random = 3;
+        auto next = [&random](size_t limit){
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            return 1 + random % limit;
+        };
+        const size_t total = 4 << 20;
+        uint8_t data[3000];
+        uint8_t out[3000];
+        size_t written = 0;
+        size_t read = 0;
+        size_t peak = 0;
+        bool same = true;
+        while(read < total){
+            size_t len = next(sizeof(data));
+            if(written < total && (buf.available() < 200000 || next(4) == 1)){
+                if(len > total - written) len = total - written;
+                for(size_t i=0; i<len; i++) data[i] = (uint8_t)((written + i) * 7);
+                CHECK_EQ(buf.write(data, len), len);
+                written += len;
+            }
+            else {
+                len = buf.read(out, len);
+                for(size_t i=0; i<len; i++) same = same && out[i] == (uint8_t)((read + i) * 7);
+                read += len;
+            }
+            if(buf.available() > peak) peak = buf.available();
+            CHECK_EQ(buf.available(), written - read);
+        }
+        CHECK(same);
+        CHECK(peak > 65535);
+    }
+}
+
+TEST(truncate){
+    xbuf buf(8);
+    buf.write("0123456789abcdefghij");
+    buf.consume(3);
+    CHECK_EQ(buf.truncate(20), 0);
+    CHECK_EQ(buf.truncate(10), 7);
+    CHECK(buf.peekString() == "3456789abc");
+    buf.write("XY");
+    CHECK(buf.peekString() == "3456789abcXY");
+    CHECK_EQ(buf.truncate(0), 12);
+    CHECK_EQ(buf.available(), 0);
+    buf.write("again");
+    CHECK(buf.readString() == "again");
+}
+
+TEST(write_stops_short_without_memory){
+    xbuf buf(8);
+    buf.write("0123");
+    hostMallocFail = 1;
+    CHECK_EQ(buf.write("456789abcd"), 4);
+    CHECK_EQ(buf.available(), 8);
+    CHECK_EQ(buf.write("efgh"), 4);
+    CHECK(buf.readString() == "01234567efgh");
+
+    xbuf from(8);
+    from.write("0123456789ab");
+    xbuf to(4);
+    to.write("zz");
+    hostMallocFail = 1;
+    CHECK_EQ(to.write(&from, 12), 2);
+    CHECK_EQ(from.available(), 10);
+    CHECK_EQ(to.write(&from, 10), 10);
+    CHECK(to.readString() == "zz0123456789ab");
+    hostMallocFail = 0;
+}
+
+TEST_MAIN()
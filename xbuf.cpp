@@ -1,12 +1,33 @@
 #include <xbuf.h>
 
-xbuf::xbuf(const uint16_t segSize)
+xseg*        xbuf::_poolFree[XBUF_POOL_CLASSES] = {};
+size_t       xbuf::_poolHeld = 0;
+size_t       xbuf::_poolHighWater = 0;
+size_t       xbuf::_poolSegSize = 0;
+bool         xbuf::_poolPSRAM = false;
+xbufLock     xbuf::_poolMux XBUF_LOCK_INIT;
+
+xbuf::xbuf(const uint16_t segSize, const size_t maxSegSize)
     : _head(nullptr)
     , _tail(nullptr)
     , _used(0)
     , _free(0)
-    , _offset(0) {
+    , _offset(0)
+    , _allocCB(nullptr)
+    , _allocCBarg(nullptr) {
+    setSegSize(segSize, maxSegSize);
+}
+
+//*******************************************************************************************************************
+void        xbuf::onAlloc(xbufAllocCB cb, void* arg){
+    _allocCB = cb;
+    _allocCBarg = arg;
+}
+
+//*******************************************************************************************************************
+void        xbuf::setSegSize(const size_t segSize, const size_t maxSegSize){
     _segSize = (segSize + 3) & -4;//((segSize + 3) >> 2) << 2;
+    _maxSegSize = maxSegSize > _segSize ? (maxSegSize + 3) & -4 : _segSize;
 }
 
 //*******************************************************************************************************************
@@ -33,16 +54,16 @@ size_t      xbuf::write(String string){
 size_t      xbuf::write(const uint8_t* buf, const size_t len){
     size_t supply = len;
     while(supply){
-        if(!_free){
-            addSeg();
+        if(!_free && ! addSeg()){
+            break;
         }
         size_t demand = _free < supply ? _free : supply;
-        memcpy(_tail->data + ((_offset + _used) % _segSize), buf + (len - supply), demand);
+        memcpy(_tail->data + (_tail->size - _free), buf + (len - supply), demand);
         _free -= demand;
         _used += demand;
         supply -= demand;
     }
-    return len;
+    return len - supply;
 }
 
 //*******************************************************************************************************************
@@ -52,12 +73,50 @@ size_t      xbuf::write(xbuf* buf, const size_t len){
         supply = buf->available();
     }
     size_t read = 0;
+
+            // When this xbuf is empty or ends on a segment boundary
+            // where the source begins, whole segments are moved
+            // by relinking them. Only a final partial segment is copied.
+
+    if( ! _head || ( ! _free && ! buf->_offset)){
+        while(buf->_head){
+            size_t segData = (buf->_offset + buf->_used) > buf->_head->size ? buf->_head->size - buf->_offset : buf->_used;
+            if(segData > supply){
+                break;
+            }
+            xseg* seg = buf->_head;
+            buf->_head = seg->next;
+            seg->next = nullptr;
+            if(_allocCB != buf->_allocCB || _allocCBarg != buf->_allocCBarg){
+                if(buf->_allocCB) buf->_allocCB(buf->_allocCBarg, -(int32_t)(sizeof(xseg) + seg->size));
+                if(_allocCB) _allocCB(_allocCBarg, sizeof(xseg) + seg->size);
+            }
+            if(_tail){
+                _tail->next = seg;
+            }
+            else {
+                _head = seg;
+                _offset = buf->_offset;
+            }
+            _tail = seg;
+            _used += segData;
+            buf->_used -= segData;
+            buf->_offset = 0;
+            read += segData;
+            supply -= segData;
+            if( ! buf->_head){
+                _free = buf->_free;
+                buf->_tail = nullptr;
+                buf->flush();
+            }
+        }
+    }
     while(supply){
-        if(!_free){
-            addSeg();
+        if(!_free && ! addSeg()){
+            break;
         }
         size_t demand = _free < supply ? _free : supply;
-        read += buf->read(_tail->data + ((_offset + _used) % _segSize), demand);
+        read += buf->read(_tail->data + (_tail->size - _free), demand);
         _free -= demand;
         _used += demand;
         supply -= demand;
@@ -83,14 +142,14 @@ uint8_t     xbuf::peek(){
 size_t      xbuf::read(uint8_t* buf, const size_t len){
     size_t read = 0;
     while(read < len && _used){
-        size_t supply = (_offset + _used) > _segSize ? _segSize - _offset : _used;
+        size_t supply = (_offset + _used) > _head->size ? _head->size - _offset : _used;
         size_t demand = len - read;
         size_t chunk = supply < demand ? supply : demand;
         memcpy(buf + read, _head->data + _offset, chunk);
         _offset += chunk;
         _used -= chunk;
         read += chunk;
-        if(_offset == _segSize){
+        if(_offset == _head->size){
             remSeg();
             _offset = 0;        
         }
@@ -109,14 +168,14 @@ size_t      xbuf::peek(uint8_t* buf, const size_t len){
     size_t offset = _offset;
     size_t used = _used;
     while(read < len && used){
-        size_t supply = (offset + used) > _segSize ? _segSize - offset : used;
+        size_t supply = (offset + used) > seg->size ? seg->size - offset : used;
         size_t demand = len - read;
         size_t chunk = supply < demand ? supply : demand;
         memcpy(buf + read, seg->data + offset, chunk);
         offset += chunk;
         used -= chunk;
         read += chunk;
-        if(offset == _segSize){
+        if(offset == seg->size){
             seg = seg->next;
             offset = 0;        
         }
@@ -124,6 +183,84 @@ size_t      xbuf::peek(uint8_t* buf, const size_t len){
     return read;
 }
 
+//*******************************************************************************************************************
+size_t      xbuf::spans(xspan* span, const size_t count, const size_t offset){
+    if(offset >= _used){
+        return 0;
+    }
+    xseg* seg = _head;
+    size_t segPos = _offset + offset;
+    size_t used = _used - offset;
+    while(segPos >= seg->size){
+        segPos -= seg->size;
+        seg = seg->next;
+    }
+    size_t filled = 0;
+    while(filled < count && used){
+        size_t len = (segPos + used) > seg->size ? seg->size - segPos : used;
+        span[filled].data = seg->data + segPos;
+        span[filled].len = len;
+        filled++;
+        used -= len;
+        segPos = 0;
+        seg = seg->next;
+    }
+    return filled;
+}
+
+//*******************************************************************************************************************
+size_t      xbuf::consume(size_t len){
+    if(len > _used){
+        len = _used;
+    }
+    size_t consumed = 0;
+    while(consumed < len){
+        size_t chunk = (_offset + _used) > _head->size ? _head->size - _offset : _used;
+        if(chunk > len - consumed){
+            chunk = len - consumed;
+        }
+        _offset += chunk;
+        _used -= chunk;
+        consumed += chunk;
+        if(_offset == _head->size){
+            remSeg();
+        }
+    }
+    if( ! _used){
+        flush();
+    }
+    return consumed;
+}
+
+//*******************************************************************************************************************
+size_t      xbuf::truncate(size_t len){
+    if(len >= _used){
+        return 0;
+    }
+    size_t discard = _used - len;
+    if( ! len){
+        flush();
+        return discard;
+    }
+    xseg* seg = _head;
+    size_t end = _offset + len;
+    while(end > seg->size){
+        end -= seg->size;
+        seg = seg->next;
+    }
+    xseg* drop = seg->next;
+    while(drop){
+        xseg* next = drop->next;
+        freeSeg(drop);
+        drop = next;
+    }
+    seg->next = nullptr;
+    _tail = seg;
+    _free = seg->size - end;
+    _used = len;
+    return discard;
+}
+
 //*******************************************************************************************************************
 size_t      xbuf::available(){
     return _used;
@@ -139,43 +276,67 @@ int      xbuf::indexOf(const char target, const size_t begin){
 //*******************************************************************************************************************
 int      xbuf::indexOf(const char* target, const size_t begin){
     size_t targetLen = strlen(target);
-    if(targetLen > _segSize || targetLen > _used) return -1;
-    size_t searchPos = _offset + begin;
-    size_t searchEnd = _offset + _used - targetLen;
-    if(searchPos > searchEnd) return -1;
-    size_t searchSeg = searchPos / _segSize;
+    if(targetLen > _used) return -1;
+    size_t index = begin;
+    size_t last = _used - targetLen;                // last index where target can start
+    if(index > last) return -1;
+    if( ! targetLen) return index;
+
+            // Locate the segment containing begin, then
+            // use memchr to find candidates for the first character
+            // and compare the rest, which may span segments.
+
     xseg* seg = _head;
-    while(searchSeg){
+    size_t segPos = _offset + begin;
+    while(segPos >= seg->size){
+        segPos -= seg->size;
         seg = seg->next;
-        searchSeg --;
-    }
-    size_t segPos = searchPos % _segSize;
-    while(searchPos <= searchEnd){
-        size_t compLen = targetLen;
-        if(compLen <= (_segSize - segPos)){
-            if(memcmp(target,seg->data+segPos,compLen) == 0){
-                return searchPos - _offset;
-            }
+    }
+    while(index <= last){
+        size_t span = seg->size - segPos;
+        if(span > last - index + 1){
+            span = last - index + 1;
         }
-        else {
-            size_t compLen = _segSize - segPos;
-            if(memcmp(target,seg->data+segPos,compLen) == 0){
-                compLen = targetLen - compLen;
-                if(memcmp(target+targetLen-compLen, seg->next->data, compLen) == 0){
-                    return searchPos - _offset;
-                }
-            }  
+        uint8_t* found = (uint8_t*) memchr(seg->data + segPos, target[0], span);
+        size_t skip = found ? found - (seg->data + segPos) : span;
+        index += skip;
+        segPos += skip;
+        if(found){
+            if(match(seg, segPos + 1, target + 1, targetLen - 1)){
+                return index;
+            }
+            index++;
+            segPos++;
         }
-        searchPos++;
-        segPos++;
-        if(segPos == _segSize){
+        if(segPos == seg->size && index <= last){
             seg = seg->next;
             segPos = 0;
-        } 
+        }
     }
     return -1;
 }
 
+//*******************************************************************************************************************
+bool     xbuf::match(xseg* seg, size_t segPos, const char* target, size_t len){
+    while(len){
+        if(segPos == seg->size){
+            seg = seg->next;
+            segPos = 0;
+        }
+        size_t chunk = seg->size - segPos;
+        if(chunk > len){
+            chunk = len;
+        }
+        if(memcmp(seg->data + segPos, target, chunk) != 0){
+            return false;
+        }
+        target += chunk;
+        segPos += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
 //*******************************************************************************************************************
 String      xbuf::readStringUntil(const char target){
     return readString(indexOf(target)+1);
@@ -191,41 +352,67 @@ String      xbuf::readStringUntil(const char* target){
 //*******************************************************************************************************************
 String      xbuf::readString(int endPos){
     String result;
-    if( ! result.reserve(endPos+1)){
-        return result;
+    if(endPos > 0){
+        readString(result, endPos);
+    }
+    return result;
+}
+
+//*******************************************************************************************************************
+size_t      xbuf::readString(String& result, size_t len){
+    if(len > _used){
+        len = _used;
     }
-    if(endPos > _used){
-        endPos = _used;
+    if( ! len || ! result.reserve(result.length() + len)){
+        return 0;
     }
-    if(endPos > 0 && result.reserve(endPos+1)){
-        while(endPos--){
-            result += (char)_head->data[_offset++];
-            _used--;
-            if(_offset >= _segSize){
-                remSeg();
-            }
+    size_t read = 0;
+    while(read < len){
+        size_t chunk = (_offset + _used) > _head->size ? _head->size - _offset : _used;
+        if(chunk > len - read){
+            chunk = len - read;
         }
-    }   
-    return result;
+        result.concat((const char*)_head->data + _offset, chunk);
+        _offset += chunk;
+        _used -= chunk;
+        read += chunk;
+        if(_offset == _head->size){
+            remSeg();
+        }
+    }
+    if( ! _used){
+        flush();
+    }
+    return read;
 }
 
 //*******************************************************************************************************************
 String      xbuf::peekString(int endPos){
     String result;
+    if(endPos <= 0){
+        return result;
+    }
+    size_t len = (size_t)endPos > _used ? _used : endPos;
+    if( ! len || ! result.reserve(len)){
+        return result;
+    }
     xseg* seg = _head;
     size_t offset = _offset;
-    if(endPos > _used){
-        endPos = _used;
-    }
-    if(endPos > 0 && result.reserve(endPos+1)){
-        while(endPos--){
-            result += (char)seg->data[offset++];
-            if( offset >= _segSize){
-                seg = seg->next;
-                offset = 0;
-            }
+    size_t used = _used;
+    while(len){
+        size_t chunk = (offset + used) > seg->size ? seg->size - offset : used;
+        if(chunk > len){
+            chunk = len;
         }
-    }   
+        result.concat((const char*)seg->data + offset, chunk);
+        offset += chunk;
+        used -= chunk;
+        len -= chunk;
+        if(offset == seg->size){
+            seg = seg->next;
+            offset = 0;
+        }
+    }
     return result;
 }
 
@@ -239,23 +426,69 @@ void        xbuf::flush(){
 }
 
 //*******************************************************************************************************************
-void        xbuf::addSeg(){
+void        xbuf::segPool(const uint16_t segSize, const size_t highWater, const bool psram){
+    xseg* drain = nullptr;
+    size_t size = (segSize + 3) & -4;
+    XBUF_LOCK(_poolMux);
+    for(int k=XBUF_POOL_CLASSES-1; k>=0; k--){
+        while(_poolFree[k] && (size != _poolSegSize || _poolHeld > highWater)){
+            xseg* seg = _poolFree[k];
+            _poolFree[k] = seg->next;
+            seg->next = drain;
+            drain = seg;
+            _poolHeld -= (size_t)1 << k;
+        }
+    }
+    _poolSegSize = highWater ? size : 0;
+    _poolHighWater = highWater;
+    _poolPSRAM = psram;
+    XBUF_UNLOCK(_poolMux);
+    while(drain){
+        xseg* next = drain->next;
+        free(drain);
+        drain = next;
+    }
+}
+
+//*******************************************************************************************************************
+int         xbuf::poolClass(const size_t size){
+    if( ! _poolSegSize){
+        return -1;
+    }
+    for(int k=0; k<XBUF_POOL_CLASSES; k++){
+        if(size <= _poolSegSize << k){
+            return k;
+        }
+    }
+    return -1;
+}
+
+//*******************************************************************************************************************
+bool        xbuf::addSeg(){
+    xseg* seg = allocSeg();
+    if( ! seg){
+        return false;
+    }
     if(_tail){
-        _tail->next = (xseg*) new uint32_t[_segSize / 4 + 1];
-        _tail = _tail->next;
+        _tail->next = seg;
+        _tail = seg;
     }
     else {
-        _tail = _head = (xseg*) new uint32_t[_segSize / 4 + 1];
+        _tail = _head = seg;
     }
     _tail->next = nullptr;
-    _free += _segSize;
+    _free += _tail->size;
+    if(_segSize < _maxSegSize){
+        _segSize = _segSize * 2 < _maxSegSize ? _segSize * 2 : _maxSegSize;
+    }
+    return true;
 }
 
 //*******************************************************************************************************************
 void        xbuf::remSeg(){
     if(_head){
         xseg *next = _head->next;
-        delete[] (uint32_t*) _head;
+        freeSeg(_head);
         _head = next;
         if( ! _head){
             _tail = nullptr;
@@ -264,3 +497,52 @@ void        xbuf::remSeg(){
     _offset = 0;
 }
 
+//*******************************************************************************************************************
+xseg*       xbuf::allocSeg(){
+    xseg* seg = nullptr;
+    size_t size = _segSize;
+    bool psram = false;
+    XBUF_LOCK(_poolMux);
+    int k = poolClass(size);
+    if(k >= 0){
+        size = _poolSegSize << k;
+        if(_poolFree[k]){
+            seg = _poolFree[k];
+            _poolFree[k] = seg->next;
+            _poolHeld -= (size_t)1 << k;
+        }
+        psram = _poolPSRAM;
+    }
+    XBUF_UNLOCK(_poolMux);
+    if( ! seg && psram){
+        seg = (xseg*) XBUF_PSRAM_MALLOC(sizeof(xseg) + size);
+    }
+    if( ! seg){
+        seg = (xseg*) XBUF_MALLOC(sizeof(xseg) + size);
+    }
+    if( ! seg){
+        return nullptr;
+    }
+    seg->size = size;
+    if(_allocCB){
+        _allocCB(_allocCBarg, sizeof(xseg) + seg->size);
+    }
+    return seg;
+}
+
+//*******************************************************************************************************************
+void        xbuf::freeSeg(xseg* seg){
+    if(_allocCB){
+        _allocCB(_allocCBarg, -(int32_t)(sizeof(xseg) + seg->size));
+    }
+    XBUF_LOCK(_poolMux);
+    int k = poolClass(seg->size);
+    if(k >= 0 && seg->size == _poolSegSize << k && _poolHeld + ((size_t)1 << k) <= _poolHighWater){
+        seg->next = _poolFree[k];
+        _poolFree[k] = seg;
+        _poolHeld += (size_t)1 << k;
+        seg = nullptr;
+    }
+    XBUF_UNLOCK(_poolMux);
+    free(seg);
+}
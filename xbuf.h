@@ -25,26 +25,84 @@
     There are other benefits as well to using smaller heap allocation units:
     1) A buffer can work fine in a fragmented heap environment (admittedly contributing to it)
     2) xbuf contents can be copied from one buffer to another without the need for 
-       2x heap during the copy.
+       2x heap during the copy. When both use the same segment size, whole segments
+       are moved from one to the other by relinking them.
     The segment size defaults to 64 but can be dynamically set in the constructor at creation.   
+    A maximum segment size can also be given, in which case each new segment is twice the
+    size of the last up to the maximum, so large contents need far fewer segments.
+    setSegSize() changes the sizes used for segments added after the call, for instance
+    when the eventual size of the contents becomes known.
     The inclusion of indexOf and read/peek until functions make it useful for handling
     data streams like HTTP, and in fact is why it was created.
 
-    NOTE: The size of the indexOf() search string is limited to the segment size.
-          It could be extended but didn't seem to be a practical consideration.    
+    Segments can optionally be recycled through a pool shared by all xbufs, see segPool().
+    The pool has XBUF_POOL_CLASSES size classes, the pool segment size doubled each
+    time (64, 128 ... 2048 by default). While it is enabled, segments up to the largest
+    class are allocated at the next class size, so xbufs with different or growing
+    segment sizes still share segments. Freed segments are kept on their class's free
+    list while the memory held stays within the high-water mark, and are reused by
+    the next addSeg() of any xbuf needing that class.
+
+    spans() exposes the buffered data in place as a list of contiguous spans,
+    so it can be parsed or written without copying, then consume() discards it.
+
+    indexOf() scans segments with memchr for the first character of the target
+    and only compares the rest at candidate positions. The target may span segments.
+
+    If a segment can't be allocated, write() stops short and returns the
+    number of bytes actually written, so callers must check the count.
+
+    onAlloc() reports segment memory as it is taken and returned (including
+    segments moved between xbufs by write(xbuf*)) so an owner can account for it.
    
 ***********************************************************************************/
 #include <Arduino.h>
 
+        // The only platform services xbuf needs are a short critical section
+        // around the segment pool and optional PSRAM allocation. They are
+        // mapped here so that xbuf can also be compiled off target, as the
+        // host tests and benchmarks in test/ do with their stub Arduino.h.
+
+#ifdef ESP32
+  typedef portMUX_TYPE xbufLock;
+  #define XBUF_LOCK_INIT          = portMUX_INITIALIZER_UNLOCKED
+  #define XBUF_LOCK(mux)          portENTER_CRITICAL(&mux)
+  #define XBUF_UNLOCK(mux)        portEXIT_CRITICAL(&mux)
+  #define XBUF_MALLOC(size)       malloc(size)
+  #define XBUF_PSRAM_MALLOC(size) ps_malloc(size)
+#else
+  #include <mutex>
+  typedef std::mutex xbufLock;
+  #define XBUF_LOCK_INIT
+  #define XBUF_LOCK(mux)          mux.lock()
+  #define XBUF_UNLOCK(mux)        mux.unlock()
+  #ifndef XBUF_MALLOC
+  #define XBUF_MALLOC(size)       malloc(size)
+  #endif
+  #define XBUF_PSRAM_MALLOC(size) XBUF_MALLOC(size)
+#endif
+
+#ifndef XBUF_POOL_CLASSES
+  #define XBUF_POOL_CLASSES 6                 // Segment pool size classes, see segPool()
+#endif
+
 struct xseg {
     xseg    *next;
+    uint32_t size;
     uint8_t data[];
 };
 
+struct xspan {
+    const uint8_t*  data;
+    size_t          len;
+};
+
+typedef void (*xbufAllocCB)(void* arg, int32_t bytes);    // segment bytes acquired (+) or released (-)
+
 class xbuf: public Print {
     public:
 
-        xbuf(const uint16_t segSize=64);
+        xbuf(const uint16_t segSize=64, const size_t maxSegSize=0);
         virtual ~xbuf();
 
         size_t      write(const uint8_t);
@@ -55,13 +113,19 @@ class xbuf: public Print {
         size_t      available();
         int         indexOf(const char, const size_t begin=0);
         int         indexOf(const char*, const size_t begin=0);
+        size_t      spans(xspan*, const size_t count, const size_t offset=0); // Fill up to count spans, return number filled
+        size_t      consume(size_t);                                // Discard from front, return bytes discarded
+        size_t      truncate(size_t);                               // Keep first len bytes, return bytes discarded
         uint8_t     read();
         size_t      read(uint8_t*, size_t);
         String      readStringUntil(const char);
         String      readStringUntil(const char*);
         String      readString(int);
+        size_t      readString(String&, size_t);                    // Append to String, return bytes read
         String      readString(){return readString(available());}
         void        flush();
+        void        setSegSize(const size_t segSize, const size_t maxSegSize=0);
+        void        onAlloc(xbufAllocCB, void* arg=0);              // Account segments taken and returned
 
         uint8_t     peek();
         size_t      peek(uint8_t*, const size_t);
@@ -70,6 +134,10 @@ class xbuf: public Print {
         String      peekString() {return peekString(_used);}
         String      peekString(int);
 
+        static void segPool(const uint16_t segSize=64,              // Recycle segments of segSize and its doubles
+                            const size_t highWater=64,              // keeping up to highWater * segSize free
+                            const bool psram=false);                // allocate pool segments in PSRAM
+
 /*      In addition to the above functions, 
         the following inherited functions from the Print class are available.  
 
@@ -105,12 +173,27 @@ class xbuf: public Print {
 
         xseg        *_head;
         xseg        *_tail;
-        uint16_t     _used;
-        uint16_t     _free;
-        uint16_t     _offset;
-        uint16_t     _segSize;
-
-        void        addSeg();
+        size_t       _used;
+        size_t       _free;
+        size_t       _offset;
+        size_t       _segSize;          // Size of next segment added
+        size_t       _maxSegSize;       // Segment size doubles up to this
+        xbufAllocCB  _allocCB;
+        void*        _allocCBarg;
+
+        bool        addSeg();
         void        remSeg();
+        bool        match(xseg*, size_t, const char*, size_t);
+        xseg*       allocSeg();
+        void        freeSeg(xseg*);
+
+        static int          poolClass(const size_t size);   // Pool class holding size, -1 if none
+
+        static xseg*        _poolFree[XBUF_POOL_CLASSES];   // Free list of recycled segments per class
+        static size_t       _poolHeld;          // Free memory held in units of _poolSegSize
+        static size_t       _poolHighWater;     // Max _poolHeld (0 = no pool)
+        static size_t       _poolSegSize;       // Smallest class, doubled for each class after
+        static bool         _poolPSRAM;         // Allocate pool segments in PSRAM
+        static xbufLock     _poolMux;
 
 };
\ No newline at end of file
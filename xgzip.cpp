@@ -0,0 +1,304 @@
+#include <xgzip.h>
+
+static const uint16_t lengthBase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t  lengthExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t distBase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t  distExtra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+// CRC-32 four bits at a time, a 64 byte table rather than 1K.
+
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+//*******************************************************************************************************************
+xgzip::xgzip(xbuf* out, const uint16_t window)
+    : _out(out)
+    , _buf(nullptr)
+    , _head(nullptr)
+    , _prev(nullptr)
+    , _window(512)
+    , _pos(0)
+    , _end(0)
+    , _crc(0xffffffff)
+    , _in(0)
+    , _outCount(0)
+    , _bits(0)
+    , _bitCount(0)
+    , _outLen(0)
+    , _finished(false)
+    , _failed(false) {
+    while(_window < window && _window < 16384){
+        _window <<= 1;
+    }
+    _buf = (uint8_t*) malloc(_window * 2);
+    _head = (uint16_t*) calloc(1 << XGZIP_HASH_BITS, sizeof(uint16_t));
+    _prev = (uint16_t*) calloc(_window, sizeof(uint16_t));
+    if( ! ok()){
+        free(_buf);
+        free(_head);
+        free(_prev);
+        _buf = nullptr;
+        _head = _prev = nullptr;
+        return;
+    }
+
+            // gzip header: deflate, no name, no time, unknown OS.
+            // Then the header of the one and only (final, fixed Huffman) block.
+
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    for(int i=0; i<10; i++){
+        putByte(header[i]);
+    }
+    putBits(1, 1);
+    putBits(1, 2);
+}
+
+//*******************************************************************************************************************
+xgzip::~xgzip(){
+    free(_buf);
+    free(_head);
+    free(_prev);
+}
+
+//*******************************************************************************************************************
+bool        xgzip::ok(){
+    return _buf && _head && _prev && ! _failed;
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::write(const uint8_t byte){
+    return write(&byte, 1);
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::write(const uint8_t* data, const size_t len){
+    if( ! _buf || _finished || _failed){
+        return 0;
+    }
+    for(size_t i=0; i<len; i++){
+        _crc ^= data[i];
+        _crc = (_crc >> 4) ^ crcTable[_crc & 15];
+        _crc = (_crc >> 4) ^ crcTable[_crc & 15];
+    }
+    _in += len;
+    size_t done = 0;
+    while(done < len){
+        if(_end == _window * 2){
+            slide();
+        }
+        size_t chunk = _window * 2 - _end;
+        if(chunk > len - done){
+            chunk = len - done;
+        }
+        memcpy(_buf + _end, data + done, chunk);
+        _end += chunk;
+        done += chunk;
+        deflate(false);
+    }
+    return len;
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::finish(){
+    if( ! _buf || _finished){
+        return _outCount;
+    }
+    deflate(true);
+    putSymbol(256);
+    if(_bitCount){
+        putByte(_bits);
+        _bits = 0;
+        _bitCount = 0;
+    }
+    uint32_t crc = _crc ^ 0xffffffff;
+    for(int i=0; i<4; i++){
+        putByte(crc >> (i * 8));
+    }
+    for(int i=0; i<4; i++){
+        putByte(_in >> (i * 8));
+    }
+    flushOut();
+    _finished = true;
+    return _outCount;
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::in(){
+    return _in;
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::out(){
+    return _outCount;
+}
+
+//*******************************************************************************************************************
+size_t      xgzip::memory(){
+    return sizeof(xgzip) + _window * 2 + (_window + (1 << XGZIP_HASH_BITS)) * sizeof(uint16_t);
+}
+
+//*******************************************************************************************************************
+void        xgzip::deflate(bool flush){
+
+            // Code input up to where a longest match could run past the
+            // end of what has been written, or all of it when flushing.
+
+    size_t keep = flush ? 0 : XGZIP_MAX_MATCH;
+    while(_end - _pos > keep){
+        size_t avail = _end - _pos;
+        size_t bestLen = 0;
+        size_t bestDist = 0;
+        if(avail >= XGZIP_MIN_MATCH){
+            size_t maxLen = avail < XGZIP_MAX_MATCH ? avail : XGZIP_MAX_MATCH;
+            uint16_t h = hash(_pos);
+            size_t candidate = _head[h];
+            int chain = XGZIP_MAX_CHAIN;
+            while(candidate && chain--){
+                size_t cand = candidate - 1;
+                if(_pos - cand >= _window){
+                    break;
+                }
+                if(_buf[cand + bestLen] == _buf[_pos + bestLen]){
+                    size_t len = 0;
+                    while(len < maxLen && _buf[cand + len] == _buf[_pos + len]){
+                        len++;
+                    }
+                    if(len > bestLen){
+                        bestLen = len;
+                        bestDist = _pos - cand;
+                        if(len == maxLen){
+                            break;
+                        }
+                    }
+                }
+                size_t next = _prev[cand & (_window - 1)];
+                if(next >= candidate){
+                    break;
+                }
+                candidate = next;
+            }
+            _prev[_pos & (_window - 1)] = _head[h];
+            _head[h] = _pos + 1;
+        }
+        if(bestLen >= XGZIP_MIN_MATCH){
+            putLength(bestLen);
+            putDistance(bestDist);
+            for(size_t i=1; i<bestLen; i++){
+                size_t pos = _pos + i;
+                if(_end - pos >= XGZIP_MIN_MATCH){
+                    uint16_t h = hash(pos);
+                    _prev[pos & (_window - 1)] = _head[h];
+                    _head[h] = pos + 1;
+                }
+            }
+            _pos += bestLen;
+        }
+        else {
+            putLiteral(_buf[_pos++]);
+        }
+    }
+}
+
+//*******************************************************************************************************************
+void        xgzip::slide(){
+
+            // Drop the oldest window of history and rebase the hash positions.
+
+    memmove(_buf, _buf + _window, _window);
+    _pos -= _window;
+    _end -= _window;
+    for(int i=0; i<(1 << XGZIP_HASH_BITS); i++){
+        _head[i] = _head[i] > _window ? _head[i] - _window : 0;
+    }
+    for(size_t i=0; i<_window; i++){
+        _prev[i] = _prev[i] > _window ? _prev[i] - _window : 0;
+    }
+}
+
+//*******************************************************************************************************************
+uint16_t    xgzip::hash(size_t pos){
+    uint32_t key = _buf[pos] | (_buf[pos + 1] << 8) | (_buf[pos + 2] << 16);
+    return (uint32_t)(key * 2654435761u) >> (32 - XGZIP_HASH_BITS);
+}
+
+//*******************************************************************************************************************
+void        xgzip::putBits(uint32_t value, int count){
+    _bits |= value << _bitCount;
+    _bitCount += count;
+    while(_bitCount >= 8){
+        putByte(_bits);
+        _bits >>= 8;
+        _bitCount -= 8;
+    }
+}
+
+//*******************************************************************************************************************
+void        xgzip::putCode(uint32_t code, int len){
+
+            // Huffman codes are packed starting with the most significant bit.
+
+    uint32_t reversed = 0;
+    for(int i=0; i<len; i++){
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    putBits(reversed, len);
+}
+
+//*******************************************************************************************************************
+void        xgzip::putLiteral(uint8_t literal){
+    if(literal < 144){
+        putCode(0x30 + literal, 8);
+    }
+    else {
+        putCode(0x190 + literal - 144, 9);
+    }
+}
+
+//*******************************************************************************************************************
+void        xgzip::putSymbol(uint16_t symbol){
+    if(symbol < 280){
+        putCode(symbol - 256, 7);
+    }
+    else {
+        putCode(0xc0 + symbol - 280, 8);
+    }
+}
+
+//*******************************************************************************************************************
+void        xgzip::putLength(size_t len){
+    int i = 28;
+    while(lengthBase[i] > len){
+        i--;
+    }
+    putSymbol(257 + i);
+    putBits(len - lengthBase[i], lengthExtra[i]);
+}
+
+//*******************************************************************************************************************
+void        xgzip::putDistance(size_t dist){
+    int i = 29;
+    while(distBase[i] > dist){
+        i--;
+    }
+    putCode(i, 5);
+    putBits(dist - distBase[i], distExtra[i]);
+}
+
+//*******************************************************************************************************************
+void        xgzip::putByte(uint8_t byte){
+    _outBuf[_outLen++] = byte;
+    _outCount++;
+    if(_outLen == sizeof(_outBuf)){
+        flushOut();
+    }
+}
+
+//*******************************************************************************************************************
+void        xgzip::flushOut(){
+    if(_out->write(_outBuf, _outLen) != _outLen){
+        _failed = true;
+    }
+    _outLen = 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+/***********************************************************************************
+    Copyright (C) <2018>  <Bob Lemaire, IoTaWatt, Inc.>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    ************************** end of license section ****************************
+
+    xgzip compresses whatever is written to it into an xbuf in gzip format.
+    Input can be written in any size pieces, compressed output is appended to
+    the xbuf as it is produced, so neither has to be held in one block.
+
+    The compressor is kept small for ESP32 heap: LZ77 matches are found with
+    hash chains in a sliding window (default 2048, up to 16384 bytes) and coded
+    as one deflate block with the fixed Huffman codes. Working memory is 4x
+    the window plus 2K of hash heads, about 10K with the default window (see
+    memory()). That gives most of the gain on repetitive text such as
+    line protocol, CSV or JSON, at a fraction of zlib's memory.
+
+    finish() must be called after the last write to complete the stream.
+
+***********************************************************************************/
+#include <Arduino.h>
+#include <xbuf.h>
+
+#define XGZIP_MIN_MATCH 3
+#define XGZIP_MAX_MATCH 258
+#define XGZIP_HASH_BITS 10
+#define XGZIP_MAX_CHAIN 16                      // Candidates tried for each match
+
+class xgzip: public Print {
+    public:
+
+        xgzip(xbuf* out, const uint16_t window=2048);
+        virtual ~xgzip();
+
+        bool        ok();                                           // Working memory was allocated and output written
+        size_t      write(const uint8_t);
+        size_t      write(const uint8_t*, const size_t);
+        size_t      finish();                                       // Complete gzip stream, return compressed size
+        size_t      in();                                           // Bytes written
+        size_t      out();                                          // Compressed bytes produced
+        size_t      memory();                                       // Working memory used
+
+    protected:
+
+        xbuf        *_out;
+        uint8_t     *_buf;              // 2 x window of input, history then lookahead
+        uint16_t    *_head;             // Latest position + 1 of each hash
+        uint16_t    *_prev;             // Previous position + 1 with same hash, by position in window
+        size_t       _window;
+        size_t       _pos;              // Next position in _buf to code
+        size_t       _end;              // End of input in _buf
+        uint32_t     _crc;
+        size_t       _in;
+        size_t       _outCount;
+        uint32_t     _bits;             // Output bits not yet written
+        int          _bitCount;
+        uint8_t      _outBuf[64];
+        size_t       _outLen;
+        bool         _finished;
+        bool         _failed;           // Output xbuf could not take all of the output
+
+        void        deflate(bool flush);
+        void        slide();
+        uint16_t    hash(size_t pos);
+        void        putBits(uint32_t value, int count);
+        void        putCode(uint32_t code, int len);
+        void        putLiteral(uint8_t);
+        void        putSymbol(uint16_t);
+        void        putLength(size_t);
+        void        putDistance(size_t);
+        void        putByte(uint8_t);
+        void        flushOut();
+};